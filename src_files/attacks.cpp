@@ -28,6 +28,10 @@ using namespace bb;
 U64 attacks::ROOK_ATTACKS  [N_SQUARES][4096]{};
 U64 attacks::BISHOP_ATTACKS[N_SQUARES][ 512]{};
 
+#ifdef USE_DISPATCH
+bool attacks::usePext = false;
+#endif
+
 U64 populateMask(U64 mask, U64 index) {
     U64    res = 0;
     Square i   = 0;
@@ -47,6 +51,12 @@ U64 populateMask(U64 mask, U64 index) {
 }
 
 void attacks::init() {
+#ifdef USE_DISPATCH
+    // pext is microcoded and slow on zen 1 and zen 2 (same as the blacklist in the makefile)
+    __builtin_cpu_init();
+    usePext = __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1")
+              && !__builtin_cpu_is("znver2");
+#endif
     for (int n = 0; n < 64; n++) {
         const auto rook_shift = rookShifts[n];
         const auto bish_shift = bishopShifts[n];
@@ -58,6 +68,10 @@ void attacks::init() {
             const U64 rel_occ      = populateMask(rookMasks[n], i);
 #ifdef USE_PEXT
             const int index        = static_cast<int>(_pext_u64(rel_occ, rookMasks[n]));
+#elif defined(USE_DISPATCH)
+            const int index        = usePext
+                                         ? static_cast<int>(pext(rel_occ, rookMasks[n]))
+                                         : static_cast<int>((rel_occ * rookMagics[n]) >> rook_shift);
 #else
             const int index        = static_cast<int>((rel_occ * rookMagics[n]) >> rook_shift);
 #endif
@@ -68,6 +82,10 @@ void attacks::init() {
             const U64 rel_occ        = populateMask(bishopMasks[n], i);
 #ifdef USE_PEXT
             const int index          = static_cast<int>(_pext_u64(rel_occ, bishopMasks[n]));
+#elif defined(USE_DISPATCH)
+            const int index          = usePext
+                                           ? static_cast<int>(pext(rel_occ, bishopMasks[n]))
+                                           : static_cast<int>((rel_occ * bishopMagics[n]) >> bish_shift);
 #else
             const int index          = static_cast<int>((rel_occ * bishopMagics[n]) >> bish_shift);
 #endif
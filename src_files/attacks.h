@@ -157,6 +157,19 @@ constexpr bb::U64 KNIGHT_ATTACKS[] {
 extern bb::U64 ROOK_ATTACKS  [bb::N_SQUARES][4096];
 extern bb::U64 BISHOP_ATTACKS[bb::N_SQUARES][ 512];
 
+#ifdef USE_DISPATCH
+// with runtime dispatch, pext is used if the cpu supports it and it is not microcoded. The
+// attack tables are indexed accordingly (see init)
+extern bool usePext;
+
+// pext is emitted using inline assembly so it can be used without compiling for bmi2
+[[nodiscard]] inline bb::U64 pext(bb::U64 source, bb::U64 mask) {
+    bb::U64 res;
+    asm("pextq %2, %1, %0" : "=r"(res) : "r"(source), "r"(mask));
+    return res;
+}
+#endif
+
 void init();
 
 bb::U64 generateSlidingAttacks(bb::Square sq, bb::Direction direction, bb::U64 occ);
@@ -174,6 +187,10 @@ bb::U64 generateBishopAttacks (bb::Square sq, bb::U64 occupied);
 #ifdef USE_PEXT
     return ROOK_ATTACKS[index][static_cast<int>(_pext_u64(occupied, rookMasks[index]))];
 #else
+#ifdef USE_DISPATCH
+    if (usePext)
+        return ROOK_ATTACKS[index][static_cast<int>(pext(occupied, rookMasks[index]))];
+#endif
     return ROOK_ATTACKS[index][static_cast<int>((occupied & rookMasks[index]) * rookMagics[index]
                                                 >> (rookShifts[index]))];
 #endif
@@ -200,6 +217,10 @@ bb::U64 generateBishopAttacks (bb::Square sq, bb::U64 occupied);
 #ifdef USE_PEXT
     return BISHOP_ATTACKS[index][static_cast<int>(_pext_u64(occupied, bishopMasks[index]))];
 #else
+#ifdef USE_DISPATCH
+    if (usePext)
+        return BISHOP_ATTACKS[index][static_cast<int>(pext(occupied, bishopMasks[index]))];
+#endif
     return BISHOP_ATTACKS[index][static_cast<int>(
         (occupied & bishopMasks[index]) * bishopMagics[index] >> (bishopShifts[index]))];
 #endif
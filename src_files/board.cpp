@@ -23,6 +23,8 @@
 #include "board.h"
 #include "uciassert.h"
 
+#include <charconv>
+
 using namespace bb;
 using namespace move;
 
@@ -36,6 +38,17 @@ constexpr float phaseValues[bb::N_PIECE_TYPES] {
  * @param fen
  */
 Board::Board(const std::string& fen) {
+    this->m_boardStatusHistory.reserve(512);
+    this->setFen(fen);
+}
+
+/**
+ * sets the board to the position described by the fen. This does not allocate any memory once the board has been
+ * used before, so it can be used to evaluate a lot of positions quickly.
+ * This might crash if the given fen is illegal in its structure. e.g. not all rows/columns specified.
+ * @param fen
+ */
+void Board::setFen(std::string_view fen) {
     // first we set all piece occupancies to zero.
     for (int i = 0; i < N_PIECES; i++) {
         m_piecesBB[i] = 0;
@@ -58,16 +71,29 @@ Board::Board(const std::string& fen) {
     
     // we need to push a default board status.
     BoardStatus boardStatus {0, 0, 0, 0, ONE, ONE, 0};
-    this->m_boardStatusHistory.reserve(512);
+    this->m_boardStatusHistory.clear();
     this->m_boardStatusHistory.push_back(boardStatus);
     
-    // using some string utilties defined in Util.h, we split the fen into parts.
-    std::vector<std::string> split = split_input_fen(fen);
+    // the fields of the fen are separated by spaces. we go through them one by one without copying them.
+    size_t pos       = 0;
+    auto   nextField = [&fen, &pos]() {
+        while (pos < fen.size() && fen[pos] == ' ')
+            pos++;
+        const size_t start = pos;
+        while (pos < fen.size() && fen[pos] != ' ')
+            pos++;
+        return fen.substr(start, pos - start);
+    };
+    auto   toInt     = [](std::string_view field) {
+        int value = 0;
+        std::from_chars(field.data(), field.data() + field.size(), value);
+        return value;
+    };
     
     // first we parse the pieces on the board.
     File x {0};
     Rank y {7};
-    for (char c : split[0]) {
+    for (char c : nextField()) {
         // we continue to the next rank and reset the file
         if (c == '/') {
             x = 0;
@@ -98,20 +124,22 @@ Board::Board(const std::string& fen) {
     }
     
     // if the fen is large enough, we parse the color next.
-    if (split.size() >= 2 && split[1].length() == 1) {
-        if (split[1].at(0) != 'w') {
+    const std::string_view color = nextField();
+    if (color.length() == 1) {
+        if (color[0] != 'w') {
             changeActivePlayer();
             getBoardStatus()->zobrist ^= ZOBRIST_WHITE_BLACK_SWAP;
         }
     }
     
     // if the fen is large enough, we parse the castling rights next.
-    if (split.size() >= 3) {
+    const std::string_view castling = nextField();
+    if (!castling.empty()) {
         for (int i = 0; i < 4; i++) {
             setCastlingRights(i, false);
         }
         
-        for (char c : split[2]) {
+        for (char c : castling) {
             switch (c) {
                 case 'K':
                     if (getPiece(E1) == WHITE_KING)
@@ -134,27 +162,32 @@ Board::Board(const std::string& fen) {
     }
     
     // e.p. square.
-    if (split.size() >= 4) {
-        if (split[3].at(0) != '-') {
-            Square square = squareIndex(split[3]);
-            setEnPassantSquare(square);
-        }
+    const std::string_view enPassant = nextField();
+    if (enPassant.length() >= 2 && enPassant[0] != '-') {
+        setEnPassantSquare(squareIndex(enPassant[1] - '1', toupper(enPassant[0]) - 'A'));
     }
     
-    if (split.size() >= 5)
-        getBoardStatus()->fiftyMoveCounter = std::stoi(split[4]);
+    const std::string_view fiftyMoves = nextField();
+    if (!fiftyMoves.empty())
+        getBoardStatus()->fiftyMoveCounter = toInt(fiftyMoves);
 
-    if (split.size() >= 6) 
-        getBoardStatus()->moveCounter = std::stoi(split[5]);
+    const std::string_view moves = nextField();
+    if (!moves.empty())
+        getBoardStatus()->moveCounter = toInt(moves);
     
     this->evaluator.reset(this);
-    // note that we do not read information about move counts. This is usually not required for playing games.
 }
 
 Board::Board(const Board& board) {
     *this = board;
 }
 
+Board::Board(const Board& board, nn::AccumulatorStack* stack, nn::AccumulatorTable* table) {
+    this->evaluator.useStack(stack);
+    this->evaluator.useTable(table);
+    *this = board;
+}
+
 /**
  * Beside using the FEN for a position, one can also copy directly for another board object.
  * Copies the entire history as well as all relevant fields.
@@ -464,7 +497,7 @@ void Board::changeActivePlayer() { m_activePlayer = 1 - m_activePlayer; }
  * Computes repetition counters as well as updating the zobrist key.
  * @param m
  */
-template<bool prefetch> void Board::move(Move m, TranspositionTable* table) {
+void Board::move(Move m) {
     BoardStatus* previousStatus = getBoardStatus();
     BoardStatus  newBoardStatus = {previousStatus->zobrist,           // zobrist will be changed later
                                   0ULL,                              // reset en passant. might be set later
@@ -572,7 +605,7 @@ template<bool prefetch> void Board::move(Move m, TranspositionTable* table) {
         if(     nn::kingSquareIndex(sqTo, color) !=
                 nn::kingSquareIndex(sqFrom, color)
                 ||  fileIndex(sqFrom) + fileIndex(sqTo) == 7){
-            this->evaluator.resetAccumulator(this, color);
+            this->evaluator.resetAccumulator(color);
         }
         
         // we need to compute the repetition count
@@ -611,9 +644,6 @@ template<bool prefetch> void Board::move(Move m, TranspositionTable* table) {
         this->setPieceHash(sqTo, pFrom);
     }
 
-    if constexpr (prefetch)
-        table->prefetch(getBoardStatus()->zobrist);
-
     // doing the initial move
     this->unsetPiece<true, false>(sqFrom);
     
@@ -627,8 +657,39 @@ template<bool prefetch> void Board::move(Move m, TranspositionTable* table) {
     this->changeActivePlayer();
     this->computeNewRepetition();
 }
-template void Board::move<false>(Move m, TranspositionTable* table);
-template void Board::move<true >(Move m, TranspositionTable* table);
+
+/**
+ * computes the zobrist key of the position after the given move. The board itself is not changed.
+ * As the zobrist key only contains the pieces and the active player, castling rights and en passant
+ * squares do not need to be considered.
+ * @param m
+ * @return
+ */
+U64 Board::keyAfter(Move m) const {
+    const Square   sqFrom = getSquareFrom(m);
+    const Square   sqTo   = getSquareTo(m);
+    const Piece    pFrom  = getMovingPiece(m);
+    const MoveType mType  = getType(m);
+
+    U64 key = getBoardStatus()->zobrist ^ ZOBRIST_WHITE_BLACK_SWAP ^ getHash(pFrom, sqFrom);
+
+    if (mType == EN_PASSANT) {
+        const Square captureSquare = sqTo - 8 * (getActivePlayer() == WHITE ? 1 : -1);
+        key ^= getHash(getPiece(captureSquare), captureSquare);
+    } else if (isCapture(m)) {
+        key ^= getHash(getPiece(sqTo), sqTo);
+    }
+
+    key ^= getHash(isPromotion(m) ? getPromotionPiece(m) : pFrom, sqTo);
+
+    if (isCastle(m)) {
+        const Piece  rook       = ROOK + 8 * getActivePlayer();
+        const Square rookSquare = sqFrom + (mType == QUEEN_CASTLE ? -4 : 3);
+        const Square rookTarget = sqTo + (mType == QUEEN_CASTLE ? 1 : -1);
+        key ^= getHash(rook, rookSquare) ^ getHash(rook, rookTarget);
+    }
+    return key;
+}
 
 /**
  * undoes the last move. Assumes the last move has not been a null move.
@@ -695,6 +756,36 @@ void Board::undoMove_null() {
     changeActivePlayer();
 }
 
+/**
+ * restores the full move from the 16 bit move stored inside the transposition table.
+ * The moving piece and the captured piece are taken from the board. If there is no piece on the
+ * starting square or nothing to capture on the target square, 0 is returned. Note that the move
+ * still needs to be checked for (pseudo) legality.
+ * @param m
+ * @return
+ */
+Move Board::decompress(CompactMove m) const {
+    if (!m)
+        return 0;
+
+    const Square   sqFrom = m & MASK<6>;
+    const Square   sqTo   = (m >> 6) & MASK<6>;
+    const MoveType mType  = m >> 12;
+    const Piece    pFrom  = getPiece(sqFrom);
+
+    if (pFrom < 0)
+        return 0;
+
+    // e.p. captures do not store the captured piece
+    if ((mType & CAPTURE_MASK) && mType != EN_PASSANT) {
+        const Piece pTo = getPiece(sqTo);
+        if (pTo < 0)
+            return 0;
+        return genMove(sqFrom, sqTo, mType, pFrom, pTo);
+    }
+    return genMove(sqFrom, sqTo, mType, pFrom);
+}
+
 /**
  * returns the Move which lead to the current position.
  * @return
@@ -1443,7 +1534,7 @@ Score Board::evaluate(){
                 / phase_sum;
     return (+     evaluation_mg_scalar
                 - phase * (evaluation_mg_scalar - evaluation_eg_scalar))
-            * (this->evaluator.evaluate(this->getActivePlayer()));
+            * (this->evaluator.evaluate(this->getActivePlayer(), this));
 }
 
 template void Board::setPiece<true, true>(Square sq, Piece piece);
@@ -30,6 +30,7 @@
 #include <sstream>
 #include <stdio.h>
 #include <string>
+#include <string_view>
 
 enum CastlingRights{
     WHITE_QUEENSIDE_CASTLING,
@@ -149,9 +150,15 @@ class Board {
     // the default constructor uses a fen-representation of the board. if nothing is specified, the starting position
     // will be used
     Board(const std::string& fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+
+    // sets the board to the given fen. Does not allocate memory, so it can be used for many positions
+    void setFen(std::string_view fen);
     
     // instead of providing the fen, we can directly clone a board object.
     Board(const Board& board);
+    // clones the board but uses the given stack for the accumulators and the given table to refresh
+    // them (see nn::Evaluator)
+    Board(const Board& board, nn::AccumulatorStack* stack, nn::AccumulatorTable* table);
     Board& operator=(const Board& board);
     
     // for the sake of completeness, we define a destructor which doesnt do anything.
@@ -185,8 +192,11 @@ class Board {
     [[nodiscard]] bb::Color getActivePlayer() const;
     
     // given a move object, does the move on the board. computes repetitions etc.
-    template<bool prefetch=false>
-    void move(move::Move m, TranspositionTable* table = nullptr);
+    void move(move::Move m);
+
+    // computes the zobrist key of the position after the given move without doing the move.
+    // this allows prefetching data for the child position early.
+    [[nodiscard]] bb::U64 keyAfter(move::Move m) const;
     
     // undoes the last move. does not require the move as the move is stored within the meta information.
     void undoMove();
@@ -197,6 +207,10 @@ class Board {
     // undoes a null-move
     void undoMove_null();
     
+    // restores a full move from the compact representation used inside the transposition table.
+    // returns 0 if the pieces on the board do not fit the given move.
+    [[nodiscard]] move::Move decompress(move::CompactMove m) const;
+
     // returns the previous move which lead to the current position.
     // this is stored within the meta information.
     [[nodiscard]] move::Move getPreviousMove(bb::Depth ply = 1) const;
@@ -289,6 +303,9 @@ class Board {
     [[nodiscard]] inline bb::U64 getPieceBB() const {return m_piecesBB[color * 8 + piece_type];}
     
     [[nodiscard]] bb::Score evaluate();
+
+    // returns the evaluator which is updated incrementally with each move
+    [[nodiscard]] inline nn::Evaluator* getEvaluator() {return &evaluator;}
 };
 
 #endif    // CHESSCOMPUTER_BOARD_H
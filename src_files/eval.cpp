@@ -19,102 +19,238 @@
 
 #include "eval.h"
 #include "board.h"
+#include "memory.h"
 #include "uciassert.h"
 
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+
 #define INCBIN_STYLE INCBIN_STYLE_CAMEL
 
 #include "incbin/incbin.h"
 
-// clang-format off
-alignas(ALIGNMENT) int16_t nn::inputWeights [INPUT_SIZE ][HIDDEN_SIZE ];
-alignas(ALIGNMENT) int16_t nn::hiddenWeights[OUTPUT_SIZE][HIDDEN_DSIZE];
-alignas(ALIGNMENT) int16_t nn::inputBias    [HIDDEN_SIZE];
-alignas(ALIGNMENT) int32_t nn::hiddenBias   [OUTPUT_SIZE];
-// clang-format on
+// incbin aligns the network for the instruction set we compile for. With runtime dispatch, the avx2 and
+// avx512 kernels load the weights with aligned loads, so the network must be aligned to 64 bytes
+#if defined(USE_DISPATCH)
+#undef  INCBIN_ALIGNMENT_INDEX
+#define INCBIN_ALIGNMENT_INDEX 6
+#endif
+
+// the network file which is mapped into memory. nullptr if the embedded network is used
+void*         mappedNetwork      = nullptr;
+mem::PageType mappedNetworkPages = mem::DEFAULT_PAGES;
+// hash of the used network. Its only computed when required to keep the startup fast
+bb::U64       usedNetworkHash    = 0;
+
+// for each view and king square, the mirroring applied to the piece squares as well as the offset of
+// the king bucket within the inputs. Used to compute the indices of incremental updates.
+struct KingBucket {
+    int mirror;
+    int offset;
+};
+
+KingBucket kingBuckets[bb::N_COLORS][bb::N_SQUARES];
 
 #define INPUT_WEIGHT_MULTIPLIER  (32)
 #define HIDDEN_WEIGHT_MULTIPLIER (128)
 
+INCBIN(Eval, EVALFILE);
+
+// the weights point to the embedded network by default. Since these are address constants, they are
+// initialised statically and can be used by boards which are created before nn::init() is called
+// clang-format off
+const int16_t (*nn::inputWeights) [HIDDEN_SIZE ] = reinterpret_cast<const int16_t(*)[HIDDEN_SIZE ]>(
+    gEvalData);
+const int16_t*  nn::inputBias                    = reinterpret_cast<const int16_t*>(
+    gEvalData + INPUT_SIZE * HIDDEN_SIZE * sizeof(int16_t));
+const int16_t (*nn::hiddenWeights)[HIDDEN_DSIZE] = reinterpret_cast<const int16_t(*)[HIDDEN_DSIZE]>(
+    gEvalData + (INPUT_SIZE + 1) * HIDDEN_SIZE * sizeof(int16_t));
+const int32_t*  nn::hiddenBias                   = reinterpret_cast<const int32_t*>(
+    gEvalData + ((INPUT_SIZE + 1) * HIDDEN_SIZE + OUTPUT_SIZE * HIDDEN_DSIZE) * sizeof(int16_t));
+// clang-format on
+
+// incremented whenever the network changes. Used to detect accumulators computed with an old network
+int networkGeneration = 0;
+
+#if defined(USE_DISPATCH)
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "runtime dispatch is only supported on x86"
+#endif
+// the kernels are compiled for multiple instruction sets. The best one supported by the cpu is chosen
+// at startup (see nn::init)
+namespace avx512 {
+#define KERNEL_AVX512
+#define KERNEL_TARGET __attribute__((target("avx512f,avx512bw,avx512dq")))
+#include "evalkernels.h"
+#undef KERNEL_TARGET
+#undef KERNEL_AVX512
+}    // namespace avx512
+
+namespace avx2 {
+#define KERNEL_AVX2
+#define KERNEL_TARGET __attribute__((target("avx2")))
+#include "evalkernels.h"
+#undef KERNEL_TARGET
+#undef KERNEL_AVX2
+}    // namespace avx2
+
+namespace sse2 {
+#define KERNEL_SSE2
+#define KERNEL_TARGET __attribute__((target("sse2")))
+#include "evalkernels.h"
+#undef KERNEL_TARGET
+#undef KERNEL_SSE2
+}    // namespace sse2
+
+namespace kernels {
+void    (*applyChanges)(int16_t* output, const int16_t* input, const int16_t* const* add, int adds,
+                        const int16_t* const* sub, int subs)                 = sse2::applyChanges;
+int32_t (*forward)(const int16_t* active, const int16_t* inactive, const int16_t* weights)
+                                                                             = sse2::forward;
+const char* name                                                             = "sse2";
+}    // namespace kernels
+#else
+// the kernels are compiled for the instruction set specified at compile time
+namespace kernels {
 #if defined(__AVX512F__)
-using avx_register_type_16 = __m512i;
-using avx_register_type_32 = __m512i;
-#define avx_madd_epi16(a, b) (_mm512_madd_epi16(a, b))
-#define avx_add_epi32(a, b)  (_mm512_add_epi32(a, b))
-#define avx_sub_epi32(a, b)  (_mm512_sub_epi32(a, b))
-#define avx_add_epi16(a, b)  (_mm512_add_epi16(a, b))
-#define avx_sub_epi16(a, b)  (_mm512_sub_epi16(a, b))
-#define avx_max_epi16(a, b)  (_mm512_max_epi16(a, b))
+#define KERNEL_AVX512
+constexpr const char* name = "avx512";
 #elif defined(__AVX2__) || defined(__AVX__)
-using avx_register_type_16 = __m256i;
-using avx_register_type_32 = __m256i;
-#define avx_madd_epi16(a, b) (_mm256_madd_epi16(a, b))
-#define avx_add_epi32(a, b)  (_mm256_add_epi32(a, b))
-#define avx_sub_epi32(a, b)  (_mm256_sub_epi32(a, b))
-#define avx_add_epi16(a, b)  (_mm256_add_epi16(a, b))
-#define avx_sub_epi16(a, b)  (_mm256_sub_epi16(a, b))
-#define avx_max_epi16(a, b)  (_mm256_max_epi16(a, b))
+#define KERNEL_AVX2
+constexpr const char* name = "avx2";
 #elif defined(__SSE2__)
-using avx_register_type_16 = __m128i;
-using avx_register_type_32 = __m128i;
-#define avx_madd_epi16(a, b) (_mm_madd_epi16(a, b))
-#define avx_add_epi32(a, b)  (_mm_add_epi32(a, b))
-#define avx_sub_epi32(a, b)  (_mm_sub_epi32(a, b))
-#define avx_add_epi16(a, b)  (_mm_add_epi16(a, b))
-#define avx_sub_epi16(a, b)  (_mm_sub_epi16(a, b))
-#define avx_max_epi16(a, b)  (_mm_max_epi16(a, b))
+#define KERNEL_SSE2
+constexpr const char* name = "sse2";
 #elif defined(__ARM_NEON)
-using avx_register_type_16 = int16x8_t;
-using avx_register_type_32 = int32x4_t;
-#define avx_madd_epi16(a, b)                                                                         \
-    (vpaddq_s32(vmull_s16(vget_low_s16(a), vget_low_s16(b)), vmull_high_s16(a, b)))
-#define avx_add_epi32(a, b) (vaddq_s32(a, b))
-#define avx_sub_epi32(a, b) (vsubq_s32(a, b))
-#define avx_add_epi16(a, b) (vaddq_s16(a, b))
-#define avx_sub_epi16(a, b) (vsubq_s16(a, b))
-#define avx_max_epi16(a, b) (vmaxq_s16(a, b))
+#define KERNEL_NEON
+constexpr const char* name = "neon";
+#endif
+#define KERNEL_TARGET
+#include "evalkernels.h"
+}    // namespace kernels
 #endif
 
-INCBIN(Eval, EVALFILE);
+/**
+ * points the weights to the given network. The network must be aligned to at least ALIGNMENT bytes
+ * and contain NETWORK_SIZE bytes. Since all parts of the network are a multiple of 64 bytes
+ * (except the final bias), each part is aligned as well.
+ * @param data
+ */
+void setNetwork(const uint8_t* data) {
+    bb::U64 memoryIndex = 0;
+    nn::inputWeights  = reinterpret_cast<const int16_t(*)[HIDDEN_SIZE]>(data + memoryIndex);
+    memoryIndex += INPUT_SIZE * HIDDEN_SIZE * sizeof(int16_t);
+    nn::inputBias     = reinterpret_cast<const int16_t*>(data + memoryIndex);
+    memoryIndex += HIDDEN_SIZE * sizeof(int16_t);
+    nn::hiddenWeights = reinterpret_cast<const int16_t(*)[HIDDEN_DSIZE]>(data + memoryIndex);
+    memoryIndex += HIDDEN_DSIZE * OUTPUT_SIZE * sizeof(int16_t);
+    nn::hiddenBias    = reinterpret_cast<const int32_t*>(data + memoryIndex);
 
-inline int32_t sumRegisterEpi32(avx_register_type_32& reg) {
-    // first summarize in case of avx512 registers into one 256 bit register
-#if defined(__AVX512F__)
-    const __m256i reduced_8 =
-        _mm256_add_epi32(_mm512_castsi512_si256(reg), _mm512_extracti32x8_epi32(reg, 1));
-#elif defined(__AVX2__) || defined(__AVX__)
-    const __m256i reduced_8 = reg;
-#endif
+    // the hash will be recomputed once its required
+    usedNetworkHash = 0;
+    networkGeneration++;
+}
 
-    // then summarize the 256 bit register into a 128 bit register
-#if defined(__AVX512F__) || defined(__AVX2__) || defined(__AVX__)
-    const __m128i reduced_4 =
-        _mm_add_epi32(_mm256_castsi256_si128(reduced_8), _mm256_extractf128_si256(reduced_8, 1));
-#elif defined(__SSE2__)
-    const __m128i reduced_4 = reg;
-#endif
+void nn::init() {
+    for (bb::Color view : {bb::WHITE, bb::BLACK}) {
+        for (bb::Square kingSquare = 0; kingSquare < bb::N_SQUARES; kingSquare++) {
+            kingBuckets[view][kingSquare].mirror = (view == bb::WHITE ? 0 : 56)
+                                                 ^ (bb::fileIndex(kingSquare) > 3 ? 7 : 0);
+            kingBuckets[view][kingSquare].offset = kingSquareIndex(kingSquare, view) * 64 * 6 * 2;
+        }
+    }
 
-#if defined(__ARM_NEON)
-    return vaddvq_s32(reg);
-#else
-    // summarize the 128 register using SSE instructions
-    __m128i vsum = _mm_add_epi32(reduced_4, _mm_srli_si128(reduced_4, 8));
-    vsum         = _mm_add_epi32(vsum, _mm_srli_si128(vsum, 4));
-    int32_t sums = _mm_cvtsi128_si32(vsum);
-    return sums;
+#if defined(USE_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq")) {
+        kernels::applyChanges = avx512::applyChanges;
+        kernels::forward      = avx512::forward;
+        kernels::name         = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernels::applyChanges = avx2::applyChanges;
+        kernels::forward      = avx2::forward;
+        kernels::name         = "avx2";
+    }
 #endif
+
+    useEmbeddedNetwork();
 }
 
-void nn::init() {
-    int memoryIndex = 0;
-    std::memcpy(inputWeights, &gEvalData[memoryIndex], INPUT_SIZE * HIDDEN_SIZE * sizeof(int16_t));
-    memoryIndex += INPUT_SIZE * HIDDEN_SIZE * sizeof(int16_t);
-    std::memcpy(inputBias, &gEvalData[memoryIndex], HIDDEN_SIZE * sizeof(int16_t));
-    memoryIndex += HIDDEN_SIZE * sizeof(int16_t);
+std::string nn::instructionSet() { return kernels::name; }
 
-    std::memcpy(hiddenWeights, &gEvalData[memoryIndex], HIDDEN_DSIZE * OUTPUT_SIZE * sizeof(int16_t));
-    memoryIndex += HIDDEN_DSIZE * OUTPUT_SIZE * sizeof(int16_t);
-    std::memcpy(hiddenBias, &gEvalData[memoryIndex], OUTPUT_SIZE * sizeof(int32_t));
-    memoryIndex += OUTPUT_SIZE * sizeof(int32_t);
+void nn::useEmbeddedNetwork() {
+    mem::freeLarge(mappedNetwork, NETWORK_SIZE, mappedNetworkPages);
+    mappedNetwork = nullptr;
+    setNetwork(gEvalData);
+}
+
+/**
+ * maps the network from the given file into memory and uses it. Only the pages of the network which
+ * are actually used will be read from the file. The mapping is shared with other processes using the
+ * same file. The network files do not contain a header, so the
+ * only thing we can validate is the size of the file.
+ * @param path
+ * @return          true if the network has been loaded
+ */
+bool nn::loadNetwork(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "info string could not open network " << path << std::endl;
+        return false;
+    }
+    const bb::U64 fileSize = file.tellg();
+    file.close();
+    if (fileSize != NETWORK_SIZE) {
+        std::cout << "info string " << path << " is not a valid network (" << fileSize
+                  << " bytes instead of " << NETWORK_SIZE << ")" << std::endl;
+        return false;
+    }
+
+    mem::PageType pages;
+    void*         network = mem::mapShared(path, NETWORK_SIZE, pages);
+    if (network == nullptr) {
+        std::cout << "info string could not map network " << path << std::endl;
+        return false;
+    }
+
+    useEmbeddedNetwork();
+    mappedNetwork      = network;
+    mappedNetworkPages = pages;
+    setNetwork(static_cast<const uint8_t*>(network));
+    return true;
+}
+
+/**
+ * the network is stored in shared memory under its hash, so processes using the same network use the
+ * same file. If shared memory is backed by huge pages, this also reduces the tlb misses when
+ * accessing the input weights.
+ * @return          true if the shared network is used
+ */
+bool nn::shareNetwork() {
+    std::stringstream name;
+    name << "koivisto-" << std::hex << networkHash() << ".net";
+    const std::string path = mem::shareData(name.str(), inputWeights, NETWORK_SIZE);
+    if (path.empty()) {
+        std::cout << "info string could not share network" << std::endl;
+        return false;
+    }
+    return loadNetwork(path);
+}
+
+bb::U64 nn::networkHash() {
+    if (usedNetworkHash == 0) {
+        // fnv-1a hash of the network
+        const auto data = reinterpret_cast<const uint8_t*>(inputWeights);
+        usedNetworkHash = 14695981039346656037ULL;
+        for (bb::U64 i = 0; i < NETWORK_SIZE; i++) {
+            usedNetworkHash = (usedNetworkHash ^ data[i]) * 1099511628211ULL;
+        }
+    }
+    return usedNetworkHash;
 }
 
 int nn::index(bb::PieceType pieceType, bb::Color pieceColor, bb::Square square, bb::Color view,
@@ -188,6 +324,11 @@ void nn::AccumulatorTable::put(bb::Color view, Board* board, nn::Accumulator& ac
 }
 
 void nn::AccumulatorTable::use(bb::Color view, Board* board, nn::Evaluator& evaluator) {
+    // the entries have been computed with a different network
+    if (generation != networkGeneration) {
+        reset();
+    }
+
     const bb::Square king_sq   = bb::bitscanForward(board->getPieceBB(view, bb::KING));
     const bool       king_side = bb::fileIndex(king_sq) > 3;
     const int        ks_index  = kingSquareIndex(king_sq, view);
@@ -200,7 +341,8 @@ void nn::AccumulatorTable::use(bb::Color view, Board* board, nn::Evaluator& eval
     AccumulatorTableEntry& entry = entries[view][entry_idx];
 
     // first retrieve the accumulator from the table and put that into the evaluator
-    std::memcpy(evaluator.history.back().summation[view], entry.accumulator.summation[view],
+    Accumulator& accumulator = evaluator.history[evaluator.ply];
+    std::memcpy(accumulator.summation[view], entry.accumulator.summation[view],
                 sizeof(int16_t) * HIDDEN_SIZE);
 
     // go through each piece and compute the difference.
@@ -219,29 +361,31 @@ void nn::AccumulatorTable::use(bb::Color view, Board* board, nn::Evaluator& eval
             // go through both sets and call the evaluator to update the accumulator
             while (to_set) {
                 bb::Square sq = bb::bitscanForward(to_set);
-                evaluator.setPieceOnSquareAccumulator<true>(view, pt, c, sq, king_sq);
+                evaluator.setPieceOnSquareAccumulator<true>(accumulator, view, pt, c, sq, king_sq);
                 to_set = bb::lsbReset(to_set);
             }
 
             while (to_unset) {
                 bb::Square sq = bb::bitscanForward(to_unset);
-                evaluator.setPieceOnSquareAccumulator<false>(view, pt, c, sq, king_sq);
+                evaluator.setPieceOnSquareAccumulator<false>(accumulator, view, pt, c, sq, king_sq);
                 to_unset = bb::lsbReset(to_unset);
             }
         }
     }
     // this set has most likely been done on a reset. its handy to just put the new state
     // into the table
-    put(view, board, evaluator.history.back());
+    put(view, board, accumulator);
 }
 
 void nn::AccumulatorTable::reset() {
     // clearing will erase all information from the table and reset every entry to an empty board.
     // This will require the accumulators to be initialised to the bias
+    generation = networkGeneration;
     for (bb::Color c : {bb::WHITE, bb::BLACK}) {
         for (int s = 0; s < 32; s++) {
             std::memcpy(entries[c][s].accumulator.summation[c], inputBias,
                         sizeof(int16_t) * HIDDEN_SIZE);
+            std::memset(entries[c][s].piece_occ, 0, sizeof(entries[c][s].piece_occ));
         }
     }
 }
@@ -249,90 +393,203 @@ void nn::AccumulatorTable::reset() {
 template<bool value>
 void nn::Evaluator::setPieceOnSquare(bb::PieceType pieceType, bb::Color pieceColor, bb::Square square,
                                      bb::Square wKingSquare, bb::Square bKingSquare) {
-    setPieceOnSquareAccumulator<value>(bb::WHITE, pieceType, pieceColor, square, wKingSquare);
-    setPieceOnSquareAccumulator<value>(bb::BLACK, pieceType, pieceColor, square, bKingSquare);
+    AccumulatorDelta& delta = deltas[ply];
+    delta.computed[bb::WHITE] = false;
+    delta.computed[bb::BLACK] = false;
+
+    // more changes than a move can cause (e.g. when setting up a position) are not recorded.
+    // instead the accumulators will be refreshed
+    if (delta.count == AccumulatorDelta::MAX_CHANGES) {
+        delta.refresh[bb::WHITE] = true;
+        delta.refresh[bb::BLACK] = true;
+        return;
+    }
+    delta.changes[delta.count++]   = {pieceType, pieceColor, square, value};
+    delta.kingSquares[bb::WHITE]   = wKingSquare;
+    delta.kingSquares[bb::BLACK]   = bKingSquare;
 }
 
 template<bool value>
-void nn::Evaluator::setPieceOnSquareAccumulator(bb::Color side, bb::PieceType pieceType,
-                                                bb::Color pieceColor, bb::Square square,
-                                                bb::Square kingSquare) {
+void nn::Evaluator::setPieceOnSquareAccumulator(Accumulator& accumulator, bb::Color side,
+                                                bb::PieceType pieceType, bb::Color pieceColor,
+                                                bb::Square square, bb::Square kingSquare) {
     const int  idx = index(pieceType, pieceColor, square, side, kingSquare);
 
-    const auto wgt = (avx_register_type_16*) (inputWeights[idx]);
-    const auto sum = (avx_register_type_16*) (history.back().summation[side]);
+    int16_t*       sum = accumulator.summation[side];
+    const int16_t* wgt = inputWeights[idx];
     if constexpr (value) {
-        for (int i = 0; i < HIDDEN_SIZE / STRIDE_16_BIT / 4; i++) {
-            sum[i * 4 + 0] = avx_add_epi16(sum[i * 4 + 0], wgt[i * 4 + 0]);
-            sum[i * 4 + 1] = avx_add_epi16(sum[i * 4 + 1], wgt[i * 4 + 1]);
-            sum[i * 4 + 2] = avx_add_epi16(sum[i * 4 + 2], wgt[i * 4 + 2]);
-            sum[i * 4 + 3] = avx_add_epi16(sum[i * 4 + 3], wgt[i * 4 + 3]);
-        }
+        kernels::applyChanges(sum, sum, &wgt, 1, nullptr, 0);
     } else {
-        for (int i = 0; i < HIDDEN_SIZE / STRIDE_16_BIT / 4; i++) {
-            sum[i * 4 + 0] = avx_sub_epi16(sum[i * 4 + 0], wgt[i * 4 + 0]);
-            sum[i * 4 + 1] = avx_sub_epi16(sum[i * 4 + 1], wgt[i * 4 + 1]);
-            sum[i * 4 + 2] = avx_sub_epi16(sum[i * 4 + 2], wgt[i * 4 + 2]);
-            sum[i * 4 + 3] = avx_sub_epi16(sum[i * 4 + 3], wgt[i * 4 + 3]);
-        }
+        kernels::applyChanges(sum, sum, nullptr, 0, &wgt, 1);
     }
-    
 }
 
 void nn::Evaluator::reset(Board* board) {
-    history.resize(1);
-    resetAccumulator(board, bb::WHITE);
-    resetAccumulator(board, bb::BLACK);
+    requireStack();
+    ply      = 0;
+    overflow = 0;
+    deltas[0] = AccumulatorDelta {};
+    table()->use(bb::WHITE, board, *this);
+    table()->use(bb::BLACK, board, *this);
+    deltas[0].computed[bb::WHITE] = true;
+    deltas[0].computed[bb::BLACK] = true;
 }
 
-void nn::Evaluator::resetAccumulator(Board* board, bb::Color color) {
-    accumulator_table->use(color, board, *this);
+void nn::Evaluator::resetAccumulator(bb::Color color) {
+    deltas[ply].refresh [color] = true;
+    deltas[ply].computed[color] = false;
 }
 
-int nn::Evaluator::evaluate(bb::Color activePlayer, Board* board) {
-    if (board != nullptr) {
-        reset(board);
+/**
+ * applies the changes which have not been applied yet to the accumulators of the current position.
+ * For each view, we walk back until we find an accumulator which is up to date and apply the changes
+ * of every move on top of it. If the king crossed a bucket on the way, the accumulator is refreshed
+ * using the accumulator table instead.
+ * @param board
+ */
+void nn::Evaluator::update(Board* board) {
+    // if the network changed, none of the accumulators can be used anymore
+    if (table()->generation != networkGeneration) {
+        for (int i = 0; i <= ply; i++) {
+            deltas[i].computed[bb::WHITE] = false;
+            deltas[i].computed[bb::BLACK] = false;
+        }
     }
-    constexpr avx_register_type_16 reluBias {};
 
-    const auto acc_act = (avx_register_type_16*) history.back().summation[activePlayer];
-    const auto acc_nac = (avx_register_type_16*) history.back().summation[!activePlayer];
+    for (bb::Color view : {bb::WHITE, bb::BLACK}) {
+        if (deltas[ply].computed[view])
+            continue;
 
-    // compute the dot product
-    avx_register_type_32 res {};
-    const auto           wgt = (avx_register_type_16*) (hiddenWeights[0]);
-    for (int i = 0; i < HIDDEN_SIZE / STRIDE_16_BIT; i++) {
-        res = avx_add_epi32(res, avx_madd_epi16(avx_max_epi16(acc_act[i], reluBias), wgt[i]));
-    }
-    for (int i = 0; i < HIDDEN_SIZE / STRIDE_16_BIT; i++) {
-        res = avx_add_epi32(res, avx_madd_epi16(avx_max_epi16(acc_nac[i], reluBias),
-                                                wgt[i + HIDDEN_SIZE / STRIDE_16_BIT]));
+        int start = ply;
+        while (!deltas[start].refresh[view] && start > 0 && !deltas[start - 1].computed[view]) {
+            start--;
+        }
+
+        if (start == 0 || deltas[start].refresh[view]) {
+            table()->use(view, board, *this);
+            deltas[ply].computed[view] = true;
+            continue;
+        }
+
+        for (int i = start; i <= ply; i++) {
+            const AccumulatorDelta& delta  = deltas[i];
+            const KingBucket&       bucket = kingBuckets[view][delta.kingSquares[view]];
+
+            // collect the weight rows of the changed features
+            const int16_t* add[AccumulatorDelta::MAX_CHANGES];
+            const int16_t* sub[AccumulatorDelta::MAX_CHANGES];
+            int            adds = 0;
+            int            subs = 0;
+            for (int c = 0; c < delta.count; c++) {
+                const FeatureChange& change = delta.changes[c];
+                const int idx = (change.square ^ bucket.mirror)
+                                + change.pieceType * 64
+                                + (change.pieceColor == view) * 64 * 6
+                                + bucket.offset;
+                if (change.add) {
+                    add[adds++] = inputWeights[idx];
+                } else {
+                    sub[subs++] = inputWeights[idx];
+                }
+            }
+
+            kernels::applyChanges(history[i].summation[view], history[i - 1].summation[view],
+                                  add, adds, sub, subs);
+            deltas[i].computed[view] = true;
+        }
     }
+}
+
+int nn::Evaluator::evaluate(bb::Color activePlayer, Board* board) {
+    update(board);
+
+    const int32_t sum = kernels::forward(history[ply].summation[activePlayer],
+                                         history[ply].summation[!activePlayer], hiddenWeights[0]);
 
-    const auto outp = sumRegisterEpi32(res) + hiddenBias[0];
+    const auto outp = sum + hiddenBias[0];
     return outp / INPUT_WEIGHT_MULTIPLIER / HIDDEN_WEIGHT_MULTIPLIER;
 }
 
-nn::Evaluator::Evaluator() {
-    this->history.push_back(Accumulator {});
-    this->accumulator_table->reset();
-}
+nn::Evaluator::Evaluator() {}
 
 nn::Evaluator::Evaluator(const nn::Evaluator& evaluator) {
-    history = evaluator.history;
+    *this = evaluator;
+}
+
+void nn::Evaluator::useTable(AccumulatorTable* table) {
+    this->accumulator_table = table;
+    this->own_table.reset();
+}
+
+nn::AccumulatorTable* nn::Evaluator::table() {
+    if (accumulator_table == nullptr) {
+        own_table         = std::make_unique<AccumulatorTable>();
+        accumulator_table = own_table.get();
+        accumulator_table->reset();
+    }
+    return accumulator_table;
 }
+void nn::AccumulatorStackDeleter::operator()(AccumulatorStack* stack) const {
+    ::operator delete(stack, std::align_val_t {alignof(AccumulatorStack)});
+}
+
+void nn::Evaluator::useStack(AccumulatorStack* stack) {
+    this->accumulator_stack = stack;
+    this->own_stack.reset();
+    this->history           = stack->history;
+    this->deltas            = stack->deltas;
+}
+
+void nn::Evaluator::requireStack() {
+    if (accumulator_stack != nullptr)
+        return;
+    // the memory is not initialised here. Only the part of the stack which is reached is written to,
+    // so boards which are only copied or searched shallowly do not touch most of it
+    own_stack.reset(static_cast<AccumulatorStack*>(
+        ::operator new(sizeof(AccumulatorStack), std::align_val_t {alignof(AccumulatorStack)})));
+    accumulator_stack = own_stack.get();
+    history           = accumulator_stack->history;
+    deltas            = accumulator_stack->deltas;
+}
+
 nn::Evaluator& nn::Evaluator::operator=(const nn::Evaluator& evaluator) {
-    this->history = evaluator.history;
+    requireStack();
+    // only the part of the stack which is in use is copied
+    std::copy(evaluator.history, evaluator.history + evaluator.ply + 1, this->history);
+    std::copy(evaluator.deltas , evaluator.deltas  + evaluator.ply + 1, this->deltas );
+    this->ply      = evaluator.ply;
+    this->overflow = evaluator.overflow;
     return *this;
 }
 
-void nn::Evaluator::addNewAccumulation() { this->history.emplace_back(this->history.back()); }
+void nn::Evaluator::addNewAccumulation() {
+    // if the stack is full, the top is reused and refreshed from the table once its evaluated
+    if (ply == bb::MAX_INTERNAL_PLY) {
+        overflow++;
+        deltas[ply] = AccumulatorDelta {};
+        resetAccumulator(bb::WHITE);
+        resetAccumulator(bb::BLACK);
+        return;
+    }
+    ply++;
+    deltas[ply] = AccumulatorDelta {};
+}
 
-void nn::Evaluator::popAccumulation() { this->history.pop_back(); }
+void nn::Evaluator::popAccumulation() {
+    if (overflow > 0) {
+        overflow--;
+        resetAccumulator(bb::WHITE);
+        resetAccumulator(bb::BLACK);
+        return;
+    }
+    ply--;
+}
 
 void nn::Evaluator::clearHistory() {
-    this->history.clear();
-    this->history.push_back(Accumulator {});
+    requireStack();
+    this->ply       = 0;
+    this->overflow  = 0;
+    this->deltas[0] = AccumulatorDelta {};
 }
 
 template void nn::Evaluator::setPieceOnSquare<true>(bb::PieceType pieceType, bb::Color pieceColor,
@@ -28,15 +28,16 @@
 #else
 #include <immintrin.h>
 #endif
-#include <vector>
 #include <memory>
+#include <string>
 
 #define INPUT_SIZE     (bb::N_PIECE_TYPES * bb::N_SQUARES * 2 * 16)
 #define HIDDEN_SIZE    (512)
 #define HIDDEN_DSIZE   (HIDDEN_SIZE * 2)
 #define OUTPUT_SIZE    (1)
  
-#if defined(__AVX512F__)
+// with runtime dispatch, the accumulators must be aligned for the widest instruction set
+#if defined(__AVX512F__) || defined(USE_DISPATCH)
 #define BIT_ALIGNMENT  (512)
 #elif defined(__AVX2__) || defined(__AVX__)
 #define BIT_ALIGNMENT  (256)
@@ -53,14 +54,39 @@ namespace nn {
 
 struct Evaluator;
 
-extern int16_t inputWeights [INPUT_SIZE][HIDDEN_SIZE];
-extern int16_t hiddenWeights[OUTPUT_SIZE][HIDDEN_DSIZE];
-extern int16_t inputBias    [HIDDEN_SIZE];
-extern int32_t hiddenBias   [OUTPUT_SIZE];
+// the weights point into the network which is currently used. This is either the network embedded
+// into the binary or a network file which has been mapped into memory
+extern const int16_t (*inputWeights) [HIDDEN_SIZE];
+extern const int16_t (*hiddenWeights)[HIDDEN_DSIZE];
+extern const int16_t*  inputBias;
+extern const int32_t*  hiddenBias;
 
-// initialise and load the weights
+// size of a network file in bytes. The weights are stored in the order listed above
+constexpr bb::U64 NETWORK_SIZE = INPUT_SIZE  * HIDDEN_SIZE  * sizeof(int16_t)
+                               + HIDDEN_SIZE                * sizeof(int16_t)
+                               + OUTPUT_SIZE * HIDDEN_DSIZE * sizeof(int16_t)
+                               + OUTPUT_SIZE                * sizeof(int32_t);
+
+// hash of the used network. Used to reject data which depends on the network (e.g. a saved hash)
+[[nodiscard]] bb::U64 networkHash();
+
+// initialise and use the embedded network
 void init();
 
+// returns the instruction set used by the kernels
+[[nodiscard]] std::string instructionSet();
+
+// uses the network embedded into the binary
+void useEmbeddedNetwork();
+
+// maps the network stored in the given file and uses it. If the file is not a valid network, the
+// current network is kept and false is returned
+bool loadNetwork(const std::string& path);
+
+// copies the current network into shared memory (unless another process did so already) and uses the
+// shared copy. This way all processes on a machine using the same network share one copy of it
+bool shareNetwork();
+
 // computes the index for a piece (piece type) and its color on the specified square
 // also takes the view from with we view at the board as well as the king square of the view side
 [[nodiscard]] int index(bb::PieceType pieceType, bb::Color pieceColor, bb::Square square,
@@ -96,6 +122,8 @@ struct AccumulatorTableEntry {
 // used but is the fastest solution.
 struct AccumulatorTable {
     AccumulatorTableEntry entries[bb::N_COLORS][32] {};
+    // the network generation the entries have been computed with (see nn::loadNetwork)
+    int                   generation = 0;
 
     // sets the specific accumulator to store the specified accumulator
     void put(bb::Color view, Board* board, Accumulator& accumulator);
@@ -105,15 +133,75 @@ struct AccumulatorTable {
     void reset();
 } __attribute__((aligned(128)));
 
+// a feature which has been added or removed from the board
+struct FeatureChange {
+    bb::PieceType pieceType;
+    bb::Color     pieceColor;
+    bb::Square    square;
+    bool          add;
+};
+
+// the changes of the features caused by a single move. They are only applied to the accumulator
+// once the position is actually evaluated. Besides the changes, we need to know the king squares
+// after the move to compute the indices. If the king of a view crossed a bucket, the accumulator
+// of that view cannot be updated incrementally and needs to be refreshed using the table.
+struct AccumulatorDelta {
+    // a move changes at most 4 features (castling)
+    static constexpr int MAX_CHANGES = 4;
+
+    FeatureChange changes[MAX_CHANGES];
+    int           count = 0;
+    bb::Square    kingSquares[bb::N_COLORS] {};
+    bool          computed   [bb::N_COLORS] {};
+    bool          refresh    [bb::N_COLORS] {};
+};
+
+// the accumulators and their pending changes for each ply. The stack has a fixed capacity so making a
+// move never allocates. Its too large to be stored within the board, so it lives on the heap
+struct AccumulatorStack {
+    // summations for each ply
+    Accumulator      history[bb::MAX_INTERNAL_PLY + 1];
+    // pending changes for each accumulator in the history
+    AccumulatorDelta deltas [bb::MAX_INTERNAL_PLY + 1];
+};
+
+// frees a stack which has been allocated by an evaluator
+struct AccumulatorStackDeleter {
+    void operator()(AccumulatorStack* stack) const;
+};
+
 struct Evaluator {
-    // summations
-    std::vector<Accumulator> history;
-    std::unique_ptr<AccumulatorTable> accumulator_table =
-        std::make_unique<AccumulatorTable>(AccumulatorTable());
+    // point into the stack used by the evaluator
+    Accumulator*     history  = nullptr;
+    AccumulatorDelta* deltas  = nullptr;
+    // the stack used by the evaluator. Search threads provide their own stack. Otherwise the evaluator
+    // allocates its own stack once its required
+    AccumulatorStack*                                          accumulator_stack = nullptr;
+    std::unique_ptr<AccumulatorStack, AccumulatorStackDeleter> own_stack;
+    // the index of the accumulator of the current position
+    int              ply      = 0;
+    // amount of moves made while the stack was full. Those positions share the top of the stack
+    int              overflow = 0;
+    // the table used to refresh the accumulators. Search threads provide their own table which
+    // persists across searches. Otherwise the evaluator allocates its own table once its required
+    AccumulatorTable*                 accumulator_table = nullptr;
+    std::unique_ptr<AccumulatorTable> own_table;
 
     Evaluator();
     
     Evaluator(const Evaluator& evaluator);
+
+    // uses the given table instead of its own one. The table must outlive the evaluator
+    void useTable(AccumulatorTable* table);
+
+    // returns the table used to refresh the accumulators
+    [[nodiscard]] AccumulatorTable* table();
+
+    // uses the given stack instead of its own one. The stack must outlive the evaluator
+    void useStack(AccumulatorStack* stack);
+
+    // makes sure the evaluator has a stack. It allocates its own stack if none has been given
+    void requireStack();
     
     Evaluator& operator=(const Evaluator& evaluator);
     
@@ -133,7 +221,8 @@ struct Evaluator {
                           bb::Square bKingSquare);
     
     template<bool value>
-    void setPieceOnSquareAccumulator(bb::Color side,
+    void setPieceOnSquareAccumulator(Accumulator& accumulator,
+                                     bb::Color side,
                                      bb::PieceType pieceType,
                                      bb::Color pieceColor,
                                      bb::Square square,
@@ -141,9 +230,13 @@ struct Evaluator {
 
     void reset(Board* board);
     
-    void resetAccumulator(Board* board, bb::Color color);
+    // marks the accumulator of the given view to be refreshed once its evaluated
+    void resetAccumulator(bb::Color color);
+
+    // applies all pending changes to the accumulator of the current position
+    void update(Board* board);
     
-    [[nodiscard]] int evaluate(bb::Color activePlayer, Board* board = nullptr);
+    [[nodiscard]] int evaluate(bb::Color activePlayer, Board* board);
 } __attribute__((aligned(128)));
 }    // namespace nn
 
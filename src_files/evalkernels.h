@@ -0,0 +1,183 @@
+
+/****************************************************************************************************
+ *                                                                                                  *
+ *                                     Koivisto UCI Chess engine                                    *
+ *                                   by. Kim Kahre and Finn Eggers                                  *
+ *                                                                                                  *
+ *                 Koivisto is free software: you can redistribute it and/or modify                 *
+ *               it under the terms of the GNU General Public License as published by               *
+ *                 the Free Software Foundation, either version 3 of the License, or                *
+ *                                (at your option) any later version.                               *
+ *                    Koivisto is distributed in the hope that it will be useful,                   *
+ *                  but WITHOUT ANY WARRANTY; without even the implied warranty of                  *
+ *                   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                  *
+ *                           GNU General Public License for more details.                           *
+ *                 You should have received a copy of the GNU General Public License                *
+ *                 along with Koivisto.  If not, see <http://www.gnu.org/licenses/>.                *
+ *                                                                                                  *
+ ****************************************************************************************************/
+
+// this file contains the simd kernels of the network. It does not have an include guard since it is
+// included once for each instruction set the kernels are compiled for (see eval.cpp). Before it is
+// included, exactly one of KERNEL_AVX512, KERNEL_AVX2, KERNEL_SSE2 and KERNEL_NEON must be defined.
+// Furthermore KERNEL_TARGET is put in front of every function (e.g. to specify a target attribute).
+
+#if defined(KERNEL_AVX512)
+using avx_register_type_16 = __m512i;
+using avx_register_type_32 = __m512i;
+#define avx_madd_epi16(a, b) (_mm512_madd_epi16(a, b))
+#define avx_add_epi32(a, b)  (_mm512_add_epi32(a, b))
+#define avx_sub_epi32(a, b)  (_mm512_sub_epi32(a, b))
+#define avx_add_epi16(a, b)  (_mm512_add_epi16(a, b))
+#define avx_sub_epi16(a, b)  (_mm512_sub_epi16(a, b))
+#define avx_max_epi16(a, b)  (_mm512_max_epi16(a, b))
+#elif defined(KERNEL_AVX2)
+using avx_register_type_16 = __m256i;
+using avx_register_type_32 = __m256i;
+#define avx_madd_epi16(a, b) (_mm256_madd_epi16(a, b))
+#define avx_add_epi32(a, b)  (_mm256_add_epi32(a, b))
+#define avx_sub_epi32(a, b)  (_mm256_sub_epi32(a, b))
+#define avx_add_epi16(a, b)  (_mm256_add_epi16(a, b))
+#define avx_sub_epi16(a, b)  (_mm256_sub_epi16(a, b))
+#define avx_max_epi16(a, b)  (_mm256_max_epi16(a, b))
+#elif defined(KERNEL_SSE2)
+using avx_register_type_16 = __m128i;
+using avx_register_type_32 = __m128i;
+#define avx_madd_epi16(a, b) (_mm_madd_epi16(a, b))
+#define avx_add_epi32(a, b)  (_mm_add_epi32(a, b))
+#define avx_sub_epi32(a, b)  (_mm_sub_epi32(a, b))
+#define avx_add_epi16(a, b)  (_mm_add_epi16(a, b))
+#define avx_sub_epi16(a, b)  (_mm_sub_epi16(a, b))
+#define avx_max_epi16(a, b)  (_mm_max_epi16(a, b))
+#elif defined(KERNEL_NEON)
+using avx_register_type_16 = int16x8_t;
+using avx_register_type_32 = int32x4_t;
+#define avx_madd_epi16(a, b)                                                                         \
+    (vpaddq_s32(vmull_s16(vget_low_s16(a), vget_low_s16(b)), vmull_high_s16(a, b)))
+#define avx_add_epi32(a, b) (vaddq_s32(a, b))
+#define avx_sub_epi32(a, b) (vsubq_s32(a, b))
+#define avx_add_epi16(a, b) (vaddq_s16(a, b))
+#define avx_sub_epi16(a, b) (vsubq_s16(a, b))
+#define avx_max_epi16(a, b) (vmaxq_s16(a, b))
+#endif
+
+// amount of 16 bit values within a register
+constexpr int STRIDE = sizeof(avx_register_type_16) / sizeof(int16_t);
+
+KERNEL_TARGET inline int32_t sumRegisterEpi32(avx_register_type_32& reg) {
+    // first summarize in case of avx512 registers into one 256 bit register
+#if defined(KERNEL_AVX512)
+    const __m256i reduced_8 =
+        _mm256_add_epi32(_mm512_castsi512_si256(reg), _mm512_extracti32x8_epi32(reg, 1));
+#elif defined(KERNEL_AVX2)
+    const __m256i reduced_8 = reg;
+#endif
+
+    // then summarize the 256 bit register into a 128 bit register
+#if defined(KERNEL_AVX512) || defined(KERNEL_AVX2)
+    const __m128i reduced_4 =
+        _mm_add_epi32(_mm256_castsi256_si128(reduced_8), _mm256_extractf128_si256(reduced_8, 1));
+#elif defined(KERNEL_SSE2)
+    const __m128i reduced_4 = reg;
+#endif
+
+#if defined(KERNEL_NEON)
+    return vaddvq_s32(reg);
+#else
+    // summarize the 128 register using SSE instructions
+    __m128i vsum = _mm_add_epi32(reduced_4, _mm_srli_si128(reduced_4, 8));
+    vsum         = _mm_add_epi32(vsum, _mm_srli_si128(vsum, 4));
+    int32_t sums = _mm_cvtsi128_si32(vsum);
+    return sums;
+#endif
+}
+
+/**
+ * computes output = input + sum(add) - sum(sub) for a single view of the accumulator. Each chunk of
+ * the input is loaded once, all the weight rows are applied and the result is stored once.
+ * The amount of rows is known at compile time for the common moves which allows the compiler to
+ * unroll the inner loops. The generic version is used for everything else.
+ * @param output
+ * @param input
+ * @param add
+ * @param sub
+ */
+template<int ADDS, int SUBS>
+KERNEL_TARGET inline void applyChanges(int16_t* output, const int16_t* input,
+                                       const int16_t* const* add, const int16_t* const* sub) {
+    const auto inp = (const avx_register_type_16*) input;
+    const auto out = (avx_register_type_16*) output;
+    for (int i = 0; i < HIDDEN_SIZE / STRIDE; i++) {
+        avx_register_type_16 reg = inp[i];
+        for (int a = 0; a < ADDS; a++) {
+            reg = avx_add_epi16(reg, ((const avx_register_type_16*) add[a])[i]);
+        }
+        for (int s = 0; s < SUBS; s++) {
+            reg = avx_sub_epi16(reg, ((const avx_register_type_16*) sub[s])[i]);
+        }
+        out[i] = reg;
+    }
+}
+
+KERNEL_TARGET inline void applyChanges(int16_t* output, const int16_t* input,
+                                       const int16_t* const* add, int adds,
+                                       const int16_t* const* sub, int subs) {
+    // quiet moves and quiet promotions
+    if (adds == 1 && subs == 1)
+        applyChanges<1, 1>(output, input, add, sub);
+    // captures, en passant and capturing promotions
+    else if (adds == 1 && subs == 2)
+        applyChanges<1, 2>(output, input, add, sub);
+    // castling
+    else if (adds == 2 && subs == 2)
+        applyChanges<2, 2>(output, input, add, sub);
+    else {
+        const auto inp = (const avx_register_type_16*) input;
+        const auto out = (avx_register_type_16*) output;
+        for (int i = 0; i < HIDDEN_SIZE / STRIDE; i++) {
+            avx_register_type_16 reg = inp[i];
+            for (int a = 0; a < adds; a++) {
+                reg = avx_add_epi16(reg, ((const avx_register_type_16*) add[a])[i]);
+            }
+            for (int s = 0; s < subs; s++) {
+                reg = avx_sub_epi16(reg, ((const avx_register_type_16*) sub[s])[i]);
+            }
+            out[i] = reg;
+        }
+    }
+}
+
+/**
+ * computes the dot product of the activated accumulators with the weights of the output layer.
+ * The accumulator of the active player comes first.
+ * @param active
+ * @param inactive
+ * @param weights
+ * @return
+ */
+KERNEL_TARGET inline int32_t forward(const int16_t* active, const int16_t* inactive,
+                                     const int16_t* weights) {
+    const avx_register_type_16 reluBias {};
+
+    const auto acc_act = (const avx_register_type_16*) active;
+    const auto acc_nac = (const avx_register_type_16*) inactive;
+
+    // compute the dot product
+    avx_register_type_32 res {};
+    const auto           wgt = (const avx_register_type_16*) weights;
+    for (int i = 0; i < HIDDEN_SIZE / STRIDE; i++) {
+        res = avx_add_epi32(res, avx_madd_epi16(avx_max_epi16(acc_act[i], reluBias), wgt[i]));
+    }
+    for (int i = 0; i < HIDDEN_SIZE / STRIDE; i++) {
+        res = avx_add_epi32(res, avx_madd_epi16(avx_max_epi16(acc_nac[i], reluBias),
+                                                wgt[i + HIDDEN_SIZE / STRIDE]));
+    }
+    return sumRegisterEpi32(res);
+}
+
+#undef avx_madd_epi16
+#undef avx_add_epi32
+#undef avx_sub_epi32
+#undef avx_add_epi16
+#undef avx_sub_epi16
+#undef avx_max_epi16
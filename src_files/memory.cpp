@@ -0,0 +1,354 @@
+
+/****************************************************************************************************
+ *                                                                                                  *
+ *                                     Koivisto UCI Chess engine                                    *
+ *                                   by. Kim Kahre and Finn Eggers                                  *
+ *                                                                                                  *
+ *                 Koivisto is free software: you can redistribute it and/or modify                 *
+ *               it under the terms of the GNU General Public License as published by               *
+ *                 the Free Software Foundation, either version 3 of the License, or                *
+ *                                (at your option) any later version.                               *
+ *                    Koivisto is distributed in the hope that it will be useful,                   *
+ *                  but WITHOUT ANY WARRANTY; without even the implied warranty of                  *
+ *                   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                  *
+ *                           GNU General Public License for more details.                           *
+ *                 You should have received a copy of the GNU General Public License                *
+ *                 along with Koivisto.  If not, see <http://www.gnu.org/licenses/>.                *
+ *                                                                                                  *
+ ****************************************************************************************************/
+
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#if defined(USE_LIBNUMA)
+#include <numa.h>
+#endif
+#elif defined(_WIN32)
+#include <malloc.h>
+#endif
+
+/**
+ * rounds the given amount of bytes up to a multiple of alignment
+ */
+static bb::U64 roundUp(bb::U64 bytes, bb::U64 alignment) {
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * allocates memory with the given alignment. bytes must be a multiple of the alignment.
+ */
+static void* alignedAlloc(bb::U64 bytes, bb::U64 alignment) {
+#if defined(_WIN32)
+    return _aligned_malloc(bytes, alignment);
+#else
+    return std::aligned_alloc(alignment, bytes);
+#endif
+}
+
+static void alignedFree(void* ptr) {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+#if defined(__linux__) && !defined(USE_LIBNUMA)
+/**
+ * reads a list of the form "0-3,8,10-11" as used within /sys and returns all contained numbers.
+ * returns an empty list if the file cannot be read.
+ */
+static std::vector<int> readList(const std::string& path) {
+    std::ifstream    file(path);
+    std::string      list;
+    std::vector<int> res;
+    std::getline(file, list);
+    if (!file)
+        return res;
+
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end   = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t      dash  = range.find('-');
+        int         first = std::stoi(range.substr(0, dash));
+        int         last  = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int i = first; i <= last; i++) {
+            res.push_back(i);
+        }
+        pos = end + 1;
+    }
+    return res;
+}
+#endif
+
+#if defined(__linux__)
+/**
+ * checks if transparent huge pages have been disabled system wide. In that case, madvise will
+ * still succeed but the memory is backed by regular pages.
+ */
+static bool transparentHugePagesDisabled() {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string   setting;
+    std::getline(file, setting);
+    return !file || setting.find("[never]") != std::string::npos;
+}
+#endif
+
+/**
+ * allocates at least the given amount of bytes. It will first try to obtain the requested page type
+ * and falls back to transparent huge pages and regular pages afterwards. Huge pages are only
+ * supported on linux. On other systems, regular pages are always used.
+ * @param bytes
+ * @param requested     the type of pages which should be used
+ * @param obtained      the type of pages which has been used
+ * @return              pointer to the memory or nullptr if no memory could be allocated
+ */
+void* mem::allocLarge(bb::U64 bytes, PageType requested, PageType& obtained) {
+    void* ptr = nullptr;
+
+#if defined(__linux__)
+    const bb::U64 hugeBytes = roundUp(bytes, HUGE_PAGE_SIZE);
+
+    if (requested == EXPLICIT_HUGE_PAGES) {
+        ptr = mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1, 0);
+        if (ptr != MAP_FAILED) {
+            obtained = EXPLICIT_HUGE_PAGES;
+            return ptr;
+        }
+        // no huge pages reserved. try transparent huge pages instead
+        requested = TRANSPARENT_HUGE_PAGES;
+    }
+
+    if (requested == TRANSPARENT_HUGE_PAGES) {
+        ptr = alignedAlloc(hugeBytes, HUGE_PAGE_SIZE);
+        if (ptr != nullptr) {
+            obtained = madvise(ptr, hugeBytes, MADV_HUGEPAGE) == 0 && !transparentHugePagesDisabled()
+                           ? TRANSPARENT_HUGE_PAGES
+                           : DEFAULT_PAGES;
+            return ptr;
+        }
+    }
+#else
+    (void) requested;
+#endif
+
+    // regular pages. the memory is still aligned to the huge page size so freeLarge does not need
+    // to distinguish between both cases
+    ptr      = alignedAlloc(roundUp(bytes, HUGE_PAGE_SIZE), HUGE_PAGE_SIZE);
+    obtained = DEFAULT_PAGES;
+    return ptr;
+}
+
+/**
+ * maps a part of a file into memory. The mapping is private so changes are not written back to the
+ * file. Pages are only read from the file once they are accessed which makes loading large files
+ * fast. On systems other than linux, the content is read into newly allocated memory.
+ * @param path
+ * @param offset    the offset within the file. Must be a multiple of 4096
+ * @param bytes     the amount of bytes to map
+ * @param obtained  the type of pages which has been used
+ * @return          pointer to the memory or nullptr if the file could not be mapped or read
+ */
+void* mem::mapFile(const std::string& path, bb::U64 offset, bb::U64 bytes, PageType& obtained) {
+#if defined(__linux__)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+    // the mapping stays valid after closing the file descriptor
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return nullptr;
+    obtained = FILE_MAPPED_PAGES;
+    return ptr;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+    void* ptr = allocLarge(bytes, DEFAULT_PAGES, obtained);
+    if (ptr == nullptr)
+        return nullptr;
+    file.seekg(offset);
+    file.read(static_cast<char*>(ptr), bytes);
+    if (!file) {
+        freeLarge(ptr, bytes, obtained);
+        return nullptr;
+    }
+    return ptr;
+#endif
+}
+
+/**
+ * maps a file read only and shared with other processes. Pages are only read once they are accessed.
+ * Files in shared memory are backed by huge pages if the kernel allows it for shared memory
+ * (/sys/kernel/mm/transparent_hugepage/shmem_enabled), so we advise it. On systems other than linux,
+ * the content is read into newly allocated memory.
+ * @param path
+ * @param bytes     the amount of bytes to map
+ * @param obtained  the type of pages which has been used
+ * @return          pointer to the memory or nullptr if the file could not be mapped or read
+ */
+void* mem::mapShared(const std::string& path, bb::U64 bytes, PageType& obtained) {
+#if defined(__linux__)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    void* ptr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return nullptr;
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+    obtained = FILE_MAPPED_PAGES;
+    return ptr;
+#else
+    return mapFile(path, 0, bytes, obtained);
+#endif
+}
+
+/**
+ * writes the data to /dev/shm/name if that file does not exist yet. The data is written to a
+ * temporary file first which is renamed afterwards so other processes never see a partial file.
+ * @param name
+ * @param data
+ * @param bytes
+ * @return          the path of the file or an empty string if it could not be created
+ */
+std::string mem::shareData(const std::string& name, const void* data, bb::U64 bytes) {
+#if defined(__linux__)
+    const std::string path = "/dev/shm/" + name;
+    if (access(path.c_str(), R_OK) == 0)
+        return path;
+
+    const std::string temp = path + "." + std::to_string(getpid());
+    std::ofstream     file(temp, std::ios::binary);
+    file.write(static_cast<const char*>(data), bytes);
+    file.close();
+    if (!file || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return "";
+    }
+    return path;
+#else
+    (void) name;
+    (void) data;
+    (void) bytes;
+    return "";
+#endif
+}
+
+/**
+ * frees memory which has been allocated using allocLarge, mapFile or mapShared.
+ * @param ptr
+ * @param bytes     the amount of bytes which have been requested
+ * @param type      the page type which has been obtained
+ */
+void mem::freeLarge(void* ptr, bb::U64 bytes, PageType type) {
+    if (ptr == nullptr)
+        return;
+#if defined(__linux__)
+    if (type == EXPLICIT_HUGE_PAGES) {
+        munmap(ptr, roundUp(bytes, HUGE_PAGE_SIZE));
+        return;
+    }
+    if (type == FILE_MAPPED_PAGES) {
+        munmap(ptr, bytes);
+        return;
+    }
+#else
+    (void) bytes;
+    (void) type;
+#endif
+    alignedFree(ptr);
+}
+
+/**
+ * returns the amount of numa nodes. Uses libnuma if available and /sys otherwise.
+ */
+int mem::numaNodes() {
+#if defined(__linux__) && defined(USE_LIBNUMA)
+    return numa_available() < 0 ? 1 : numa_num_configured_nodes();
+#elif defined(__linux__)
+    return std::max(1, static_cast<int>(readList("/sys/devices/system/node/online").size()));
+#else
+    return 1;
+#endif
+}
+
+/**
+ * sets the memory policy of the given memory to interleave its pages across all nodes. The policy
+ * is applied when the pages are touched first so this must be called directly after allocating.
+ * Uses libnuma if available and the mbind system call otherwise.
+ * @param ptr
+ * @param bytes
+ * @return      true if the pages are interleaved across multiple nodes
+ */
+bool mem::interleave(void* ptr, bb::U64 bytes) {
+    if (numaNodes() < 2)
+        return false;
+#if defined(__linux__) && defined(USE_LIBNUMA)
+    numa_interleave_memory(ptr, bytes, numa_all_nodes_ptr);
+    return true;
+#elif defined(__linux__)
+    // MPOL_INTERLEAVE from numaif.h
+    constexpr int     interleaveMode = 3;
+    constexpr int     maxNodes       = 1024;
+    unsigned long     mask[maxNodes / (8 * sizeof(unsigned long))] {};
+    for (int node : readList("/sys/devices/system/node/online")) {
+        if (node < maxNodes)
+            mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    }
+    return syscall(SYS_mbind, ptr, bytes, interleaveMode, mask, maxNodes + 1, 0) == 0;
+#else
+    (void) ptr;
+    (void) bytes;
+    return false;
+#endif
+}
+
+/**
+ * restricts the calling thread to the cpus of the given numa node.
+ * @param node
+ * @return      true if the thread has been bound
+ */
+bool mem::bindToNode(int node) {
+#if defined(__linux__) && defined(USE_LIBNUMA)
+    return numa_available() >= 0 && numa_run_on_node(node) == 0;
+#elif defined(__linux__)
+    std::vector<int> cpus = readList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (cpus.empty())
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) node;
+    return false;
+#endif
+}
+
+std::string mem::toString(PageType type) {
+    switch (type) {
+        case TRANSPARENT_HUGE_PAGES: return "transparent huge pages";
+        case EXPLICIT_HUGE_PAGES: return "explicit huge pages";
+        case FILE_MAPPED_PAGES: return "file mapped pages";
+        default: return "default pages";
+    }
+}
@@ -0,0 +1,78 @@
+
+/****************************************************************************************************
+ *                                                                                                  *
+ *                                     Koivisto UCI Chess engine                                    *
+ *                                   by. Kim Kahre and Finn Eggers                                  *
+ *                                                                                                  *
+ *                 Koivisto is free software: you can redistribute it and/or modify                 *
+ *               it under the terms of the GNU General Public License as published by               *
+ *                 the Free Software Foundation, either version 3 of the License, or                *
+ *                                (at your option) any later version.                               *
+ *                    Koivisto is distributed in the hope that it will be useful,                   *
+ *                  but WITHOUT ANY WARRANTY; without even the implied warranty of                  *
+ *                   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                  *
+ *                           GNU General Public License for more details.                           *
+ *                 You should have received a copy of the GNU General Public License                *
+ *                 along with Koivisto.  If not, see <http://www.gnu.org/licenses/>.                *
+ *                                                                                                  *
+ ****************************************************************************************************/
+
+#ifndef KOIVISTO_MEMORY_H
+#define KOIVISTO_MEMORY_H
+
+#include "bitboard.h"
+
+#include <string>
+
+namespace mem {
+
+// large tables like the transposition table are accessed randomly. Backing them with 2MB pages
+// instead of 4KB pages reduces the amount of TLB misses significantly.
+enum PageType {
+    DEFAULT_PAGES,             // regular 4KB pages
+    TRANSPARENT_HUGE_PAGES,    // 2MB aligned memory which is advised to the kernel (madvise)
+    EXPLICIT_HUGE_PAGES,       // memory from the hugetlbfs pool (requires reserved huge pages)
+    FILE_MAPPED_PAGES,         // private (copy on write) mapping of a file
+};
+
+constexpr bb::U64 HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// allocates at least the given amount of bytes aligned to at least a cache line. It tries to
+// obtain the requested page type and falls back to the next smaller one if not available.
+// the type of pages which has actually been obtained is written to obtained.
+// returns nullptr if no memory could be allocated at all.
+[[nodiscard]] void* allocLarge(bb::U64 bytes, PageType requested, PageType& obtained);
+
+// maps bytes of the given file starting at offset (a multiple of 4096) into memory. The memory can
+// be written to without affecting the file. If mapping is not supported, the content is read into
+// memory from allocLarge instead. returns nullptr if the file cannot be read.
+[[nodiscard]] void* mapFile(const std::string& path, bb::U64 offset, bb::U64 bytes, PageType& obtained);
+
+// maps the given file read only. Since the mapping is shared, all processes mapping the same file use
+// the same physical memory. If the file lives in shared memory (see shareData), huge pages are used
+// if enabled for shared memory. returns nullptr if the file cannot be read.
+[[nodiscard]] void* mapShared(const std::string& path, bb::U64 bytes, PageType& obtained);
+
+// stores the given data in shared memory under the given name unless it already exists, so it can be
+// mapped by multiple processes using mapShared. returns the path to the shared memory or an empty
+// string if shared memory is not supported.
+[[nodiscard]] std::string shareData(const std::string& name, const void* data, bb::U64 bytes);
+
+// frees memory allocated with allocLarge, mapFile or mapShared. bytes and type must match the allocation.
+void freeLarge(void* ptr, bb::U64 bytes, PageType type);
+
+[[nodiscard]] std::string toString(PageType type);
+
+// returns the amount of numa nodes. 1 if the system is not a numa system or it cannot be detected.
+[[nodiscard]] int numaNodes();
+
+// interleaves the pages of the given memory across all numa nodes. This must be done before the
+// memory is touched. returns true if the memory will be spread across multiple nodes.
+bool interleave(void* ptr, bb::U64 bytes);
+
+// binds the calling thread to the cpus of the given numa node. returns true on success.
+bool bindToNode(int node);
+
+}    // namespace mem
+
+#endif    // KOIVISTO_MEMORY_H
@@ -168,6 +168,22 @@ inline void setCapturedPiece(Move& move, const bb::Piece capturedPiece) {
     return move & 0x80000;
 }
 
+// the transposition table only stores the squares and the type of a move within 16 bits.
+// the moving and captured piece can be recovered from the board (see Board::decompress)
+//
+//  0000 000000 000000
+// |    |      |      squareFrom
+// |    |      +------
+// |    |             squareTo
+// |    +-------------
+// |                  type information
+// +------------------
+using CompactMove = uint16_t;
+
+[[nodiscard]] inline CompactMove  compress            (Move move){
+    return (move & MASK<12>) | (getType(move) << 12);
+}
+
 [[nodiscard]] std::string toString(const Move& move);
 void                      printMoveBits(Move move, bool bitInfo = true);
 
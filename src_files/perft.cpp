@@ -21,9 +21,21 @@
 #include "move.h"
 #include "movegen.h"
 
+#include <cstring>
+
+
+// the transposition table only stores 16 bit moves which cannot hold node counts. perft therefor
+// uses its own simple table which stores the full key, the depth and the amount of nodes.
+struct PerftEntry {
+    bb::U64 zobrist;
+    bb::U64 nodes;
+    int     depth;
+};
+
+constexpr bb::U64 PERFT_TT_SIZE = 1ULL << 24;
 
 move::MoveList**    perft_mvlist_buffer;
-TranspositionTable* perft_tt;
+PerftEntry*         perft_tt = nullptr;
 
 /**
  * called at the start of the program
@@ -31,7 +43,7 @@ TranspositionTable* perft_tt;
  */
 void perft_init(bool hash) {
     if (hash)
-        perft_tt = new TranspositionTable(512);
+        perft_tt = new PerftEntry[PERFT_TT_SIZE] {};
 
     perft_mvlist_buffer = new move::MoveList*[100];
 
@@ -45,7 +57,8 @@ void perft_init(bool hash) {
  */
 void perft_cleanUp() {
     if (perft_tt != nullptr)
-        delete perft_tt;
+        delete[] perft_tt;
+    perft_tt = nullptr;
 
     for (int i = 0; i < 100; i++) {
         delete perft_mvlist_buffer[i];
@@ -77,13 +90,18 @@ bb::U64 perft(Board* b, int depth, bool print, bool d1, bool hash, int ply) {
     bb::U64 zob = bb::ZERO;
     if (hash) {
         if (ply == 0) {
-            perft_tt->clear();
+            std::memset(perft_tt, 0, sizeof(PerftEntry) * PERFT_TT_SIZE);
         }
 
-        zob      = b->zobrist();
-        Entry en = perft_tt->get(zob);
+        // the zobrist key does not contain castling rights and e.p. squares which are relevant for
+        // perft. we mix them into the key used for the perft table.
+        zob  = b->zobrist();
+        zob ^= b->getBoardStatus()->castlingRights * 0x9E3779B97F4A7C15ULL;
+        zob ^= b->getBoardStatus()->enPassantTarget * 0xC2B2AE3D27D4EB4FULL;
+
+        const PerftEntry& en = perft_tt[zob & (PERFT_TT_SIZE - 1)];
         if (en.depth == depth && en.zobrist == zob) {
-            return en.move;
+            return en.nodes;
         }
     }
 
@@ -123,7 +141,7 @@ bb::U64 perft(Board* b, int depth, bool print, bool d1, bool hash, int ply) {
     }
 
     if (hash) {
-        perft_tt->put(zob, 0, nodes, 0, depth, 0);
+        perft_tt[zob & (PERFT_TT_SIZE - 1)] = {zob, nodes, depth};
     }
 
     return nodes;
@@ -28,6 +28,8 @@
 #include "polyglot.h"
 #include "syzygy/tbprobe.h"
 
+#include <iomanip>
+#include <sstream>
 #include <thread>
 
 using namespace attacks;
@@ -36,6 +38,12 @@ using namespace move;
 
 int  lmrReductions[256][256];
 
+// helper threads skip the depths for which ((depth + phase) / size) is odd. Each helper uses a
+// different combination of size and phase so that the threads search different depths at a time.
+constexpr int SKIP_TABLE_SIZE = 20;
+constexpr int skipSize [SKIP_TABLE_SIZE] {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+constexpr int skipPhase[SKIP_TABLE_SIZE] {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+
 int  RAZOR_MARGIN     = 190;
 int  FUTILITY_MARGIN  = 68;
 int  SE_MARGIN_STATIC = 0;
@@ -191,6 +199,8 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
     // if the main thread calls this function, we need to generate the search data for all the threads
     // first
     if (threadId == 0) {
+        // the transposition table might still be resized or cleared in the background
+        waitForHash();
         
         // store the time manager locally
         // also dtz probing will use the time manager
@@ -214,6 +224,7 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
         
         // we need to reset the hash between searches
         this->table->incrementAge();
+        this->searchedNodes.store(0, std::memory_order_relaxed);
 
         // for each thread, we will reset the thread data like node counts, tablebase hits etc.
         for (size_t i = 0; i < tds.size(); i++) {
@@ -221,7 +232,9 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
             this->tds[i].threadID      = i;
             this->tds[i].tbhits        = 0;
             this->tds[i].nodes         = 0;
+            this->tds[i].publishedNodes.store(0);
             this->tds[i].rootMoveCount = rootMoves.getSize();
+            this->tds[i].completedDepth = 0;
 
             for (int m = 0; m < rootMoves.getSize(); ++m) {
                 this->tds[i].rootMoves[m].seldepth  = 0;
@@ -232,10 +245,14 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
             }
         }
 
-        // we will call this function for the other threads which will skip this part and jump
+        // we will wake up the other threads which will call this function, skip this part and jump
         // straight to the part below
-        for (int n = 1; n < threadCount; n++) {
-            this->runningThreads.emplace_back(&Search::bestMove, this, b, timeman, n);
+        if (threadCount > 1) {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            helperBoard    = b;
+            helpersRunning = threadCount - 1;
+            helperSearchId++;
+            poolStart.notify_all();
         }
     }
 
@@ -251,16 +268,33 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
     // Also, its relevant because if we stop the search even if the search has not finished, the board
     // object will have a random position from the tree. Using this would lead to an illegal/not
     // existing pv
-    Board       searchBoard {*b};
+    Board       searchBoard {*b, &td->accumulatorStack, &td->accumulatorTable};
     Board       printBoard {*b};
     // dropout means that we stopped the search. It is important to reset this before we
     // start searching.
     td->dropOut = false;
+    // helper threads start at different depths and use different aspiration windows to not search
+    // the same trees as the other threads
+    Depth startDepth = 1;
+    Score windowSize = 10;
+    if (threadId > 0) {
+        startDepth  = std::min(maxDepth, static_cast<Depth>(1 + threadId % (helperStagger + 1)));
+        windowSize += (threadId % 4) * helperAspirationOffset;
+    }
     // start the main iterative deepening loop
     Depth depth;
-    for (depth = 1; depth <= maxDepth; depth++) {
+    for (depth = startDepth; depth <= maxDepth; depth++) {
+        // helper threads skip some depths based on their thread id. The final depth is never skipped
+        if (threadId > 0 && helperDepthSkip && depth < maxDepth) {
+            const int idx = (threadId - 1) % SKIP_TABLE_SIZE;
+            if (((depth + skipPhase[idx]) / skipSize[idx]) % 2)
+                continue;
+        }
+
         // Keep track of when the timeman stops the search
         bool timemanAbort = false;
+        // Keep track of whether all windows of this depth returned a score within their bounds
+        bool exact        = true;
 
         for (td->pvIdx = 0; td->pvIdx < multiPv; ++td->pvIdx) {
             for (uint16_t& len : td->pvLen) {
@@ -275,11 +309,17 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
             } else {
                 score = prevScore = td->rootMoves[td->pvIdx].prevScore;
                 // initial window size
-                Score window = 10;
+                Score window = windowSize;
                 // lower and upper bounds
                 Score alpha  = score - window;
                 Score beta   = score + window;
                 Depth sDepth = depth;
+                // if there is no time left, this iteration is interrupted before it even started. This
+                // can happen to helper threads which skipped the previous depths
+                if (!this->timeManager->isTimeLeft())
+                    td->dropOut = true;
+                // a score on the bound of the last window is only a bound of the real score
+                bool inside = false;
                 // widen the window as long as time is left
                 while (this->timeManager->isTimeLeft()) {
                     sDepth = sDepth < depth - 3 ? depth - 3 : sDepth;
@@ -296,13 +336,16 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
                         beta = (alpha + beta) / 2;
                         alpha -= window;
                     } else {
+                        inside = true;
                         break;
                     }
                 }
+                exact = exact && inside;
             }
             // compute a score which puts the nodes we spent looking at the best move
             // in relation to all the nodes searched so far (only thread local)
-            int timeManScore = td->searchData.spentEffort[getSquareFrom(td->searchData.bestMove)]
+            int timeManScore = td->nodes == 0 ? 0 :
+                               td->searchData.spentEffort[getSquareFrom(td->searchData.bestMove)]
                                                         [getSquareTo  (td->searchData.bestMove)]
                             * 100 / td->nodes;
 
@@ -322,6 +365,8 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
             // print the info string if its the main thread, don't do partial multipv
             // updates when elapsed time is low to avoid cluttering stdout
             if (threadId == 0 && (td->pvIdx + 1 == multiPv || (depth > 1 && this->timeManager->elapsedTime() >= 3000))) {
+                // make sure the node count of the main thread is up to date
+                publishNodes(td);
                 for (int pvLine = 0; pvLine < td->pvIdx + 1; ++pvLine) {
                     this->printInfoString(depth,
                                           td->rootMoves[pvLine].seldepth,
@@ -348,6 +393,12 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
             }
         }
 
+        // remember the best root move if the iteration has not been interrupted and its score is exact
+        if (!td->dropOut && exact) {
+            td->completedDepth = depth;
+            td->completed      = td->rootMoves[0];
+        }
+
         // Update the prevScore of each rootMove, and reset the score
         for (RootMove& rootMove: td->rootMoves) {
             rootMove.prevScore = rootMove.score;
@@ -358,17 +409,34 @@ Move Search::bestMove(Board* b, TimeManager* timeman, int threadId) {
             break;
     }
 
+    // the node count of this thread is final
+    publishNodes(td);
+
     // if the main thread finishes, we will record the data of this thread
     if (threadId == 0) {
         // tell all other threads if they are running to stop the search
         timeman->stopSearch();
-        for (std::thread& th : this->runningThreads) {
-            th.join();
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            poolDone.wait(lock, [this] { return helpersRunning == 0; });
         }
-        this->runningThreads.clear();
 
-        // retrieve the best move from the search
-        Move best = td->searchData.bestMove;
+        // retrieve the best move from the search. If another thread found a better move, we use its
+        // move and print its pv
+        Move        best       = td->searchData.bestMove;
+        ThreadData* bestThread = this->bestThread();
+        if (bestThread != td) {
+            best     = bestThread->completed.pv[0];
+            topScore = bestThread->completed.score;
+            this->printInfoString(bestThread->completedDepth,
+                                  bestThread->completed.seldepth,
+                                  bestThread->completed.score,
+                                  bestThread->completed.pv,
+                                  bestThread->completed.pvLen, 0);
+        }
+
+        if (hashStats && printInfo)
+            printHashStats();
 
         // collect some information which can be used for benching
         this->searchOverview.nodes = this->totalNodes();
@@ -400,24 +468,25 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
     UCI_ASSERT(beta > alpha);
     UCI_ASSERT(ply >= 0);
 
-    // increment the node counter for the current thread
+    // increment the node counter for the current thread and publish it from time to time
     td->nodes++;
+    if (td->nodes - td->publishedNodes.load() >= NODE_BATCH) {
+        publishNodes(td);
+        // we don't want to read the clock at every node for speed reasons. Instead we check it
+        // together with publishing the nodes which sets the stop flag once the time is over
+        timeManager->checkTime(&td->searchData);
+    }
 
-    // force a stop when enough nodes have been searched
+    // force a stop when enough nodes have been searched by all threads. Besides the nodes published
+    // by all threads, this includes the nodes of this thread which have not been published yet
     if (   timeManager->node_limit.enabled
-        && timeManager->node_limit.nodes <= td->nodes) {
+        && timeManager->node_limit.nodes
+               <= searchedNodes.load(std::memory_order_relaxed) + td->nodes - td->publishedNodes.load()) {
         this->timeManager->stopSearch();
     }
 
-    // check if a stop is forced
-    if (timeManager->force_stop) {
-        td->dropOut = true;
-        return beta;
-    }
-
-    // if the time is over, we fail hard to stop the search. We don't want to call the system clock
-    // too often for speed reasons, so we only apply this when the depth is larger than 6.
-    if ((depth > 6 && !timeManager->isTimeLeft(&td->searchData))) {
+    // if a stop is forced or the time is over, we fail hard to stop the search
+    if (timeManager->isStopped()) {
         td->dropOut = true;
         return beta;
     }
@@ -480,10 +549,15 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
     // the current position. First, we adjust the static evaluation and second, we might be able to
     // return the tablebase score if the depth of that entry is larger than our current depth.
     // ***********************************************************************************************
-    Entry en = table->get(key);
+    Entry en = table->get(key, &td->ttStats);
+
+    if (en.zobrist == verificationKey(key) && !skipMove) {
+        hashMove = b->decompress(en.move);
 
-    if (en.zobrist == key >> 32 && !skipMove) {
-        hashMove = en.move;
+        // a stored move which does not fit the position means that the entry belongs to another
+        // position with the same key
+        if (en.move && !hashMove)
+            td->ttStats.collisions++;
 
         staticEval = en.eval;
 
@@ -508,7 +582,7 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
         if (inCheck)
             staticEval = -MAX_MATE_SCORE + ply;
         else {
-            staticEval = b->evaluate();
+            staticEval = td->evalCache.evaluate(b);
         }
     }
 
@@ -531,7 +605,7 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
     sd->setHistoricEval(staticEval, b->getActivePlayer(), ply);
     bool  isImproving = inCheck ? false : sd->isImproving(staticEval, b->getActivePlayer(), ply);
 
-    if (en.zobrist == key >> 32) {
+    if (en.zobrist == verificationKey(key)) {
         // adjusting eval
         if (   (en.type == PV_NODE)
             || (en.type == CUT_NODE && staticEval < en.score)
@@ -639,7 +713,9 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
             if (!b->isLegal(m))
                 continue;
 
-            b->move<true>(m, table);
+            table->prefetch(b->keyAfter(m));
+
+            b->move(m);
 
             Score qScore = -qSearch(b, -betaCut, -betaCut + 1, ply + 1, td);
 
@@ -649,7 +725,8 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
             b->undoMove();
 
             if (qScore >= betaCut) {
-                table->put(key, qScore, m, CUT_NODE, depth - 3, sd->eval[b->getActivePlayer()][ply]);
+                table->put(key, qScore, m, CUT_NODE, depth - 3, sd->eval[b->getActivePlayer()][ply],
+                           &td->ttStats);
                 return betaCut;
             }
         }
@@ -703,7 +780,7 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
         if (ply == 0 && std::find(&td->rootMoves[0], &td->rootMoves[td->pvIdx], m) != &td->rootMoves[td->pvIdx])
             continue ;
 
-        if (pv && td->threadID == 0)
+        if (pv)
             td->pvLen[ply + 1] = 0;
 
         // check if the move gives check and/or its promoting
@@ -767,6 +844,10 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
             continue;
         }
 
+        // the move will most likely be searched. start loading the transposition table entry of the
+        // child while extensions and reductions are computed.
+        table->prefetch(b->keyAfter(m));
+
         if (ply == 0 && depth == 1) {
             sd->spentEffort[getSquareFrom(m)][getSquareTo(m)] = 0;
         }
@@ -871,7 +952,7 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
         }
 
         // doing the move
-        b->move<true>(m, table);
+        b->move(m);
 
         // adjust the extension policy for checks.
         if (extension == 0 && depth > 4 && b->isInCheck(b->getActivePlayer()))
@@ -925,7 +1006,7 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
                 sd->bestMove = m;
                 alpha        = highestScore;
             }
-            if (pv && td->threadID == 0) {
+            if (pv) {
                 td->pv[ply][0] = m;
                 memcpy(&td->pv[ply][1], &td->pv[ply + 1][0], sizeof(move::Move) * td->pvLen[ply + 1]);
                 td->pvLen[ply] = td->pvLen[ply + 1] + 1;
@@ -937,7 +1018,8 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
         if (score >= beta) {
             if (!skipMove && !td->dropOut) {
                 // put the beta cutoff into the perft_tt
-                table->put(key, score, m, CUT_NODE, depth, sd->eval[b->getActivePlayer()][ply]);
+                table->put(key, score, m, CUT_NODE, depth, sd->eval[b->getActivePlayer()][ply],
+                           &td->ttStats);
             }
             // also set this move as a killer move into the history
             if (!isCapture(m) && !isPromotion)
@@ -987,20 +1069,20 @@ Score Search::pvSearch(Board* b, Score alpha, Score beta, Depth depth, Depth ply
     if (!skipMove && !td->dropOut) {
         if (alpha > originalAlpha) {
             table->put(key, highestScore, bestMove, PV_NODE, depth,
-                       sd->eval[b->getActivePlayer()][ply]);
+                       sd->eval[b->getActivePlayer()][ply], &td->ttStats);
         } else {
             if (hashMove && en.type == CUT_NODE) {
-                bestMove = en.move;
+                bestMove = hashMove;
             } else if (highestScore == alpha && !sameMove(hashMove, bestMove)) {
                 bestMove = 0;
             }
 
             if (depth > 7 && bestMove && (td->nodes - prevNodeCount) / 2 < bestNodeCount) {
                 table->put(key, highestScore, bestMove, FORCED_ALL_NODE, depth,
-                           sd->eval[b->getActivePlayer()][ply]);
+                           sd->eval[b->getActivePlayer()][ply], &td->ttStats);
             } else {
                 table->put(key, highestScore, bestMove, ALL_NODE, depth,
-                           sd->eval[b->getActivePlayer()][ply]);
+                           sd->eval[b->getActivePlayer()][ply], &td->ttStats);
             }
         }
     }
@@ -1028,7 +1110,7 @@ Score Search::qSearch(Board* b, Score alpha, Score beta, Depth ply, ThreadData*
     // extract information like search data (history tables), zobrist etc
     SearchData* sd         = &td->searchData;
     U64         key        = b->zobrist();
-    Entry       en         = table->get(b->zobrist());
+    Entry       en         = table->get(b->zobrist(), &td->ttStats);
     NodeType    ttNodeType = ALL_NODE;
 
     Score stand_pat;
@@ -1041,7 +1123,7 @@ Score Search::qSearch(Board* b, Score alpha, Score beta, Depth ply, ThreadData*
     // perft_tt entry.
     // ***********************************************************************************************
 
-    if (en.zobrist == key >> 32) {
+    if (en.zobrist == verificationKey(key)) {
         if (en.type == PV_NODE) {
             return en.score;
         } else if (en.type == CUT_NODE) {
@@ -1055,11 +1137,11 @@ Score Search::qSearch(Board* b, Score alpha, Score beta, Depth ply, ThreadData*
         }
         stand_pat = bestScore = en.eval;
     } else {
-        stand_pat = bestScore = inCheck ? -MAX_MATE_SCORE + ply : b->evaluate();
+        stand_pat = bestScore = inCheck ? -MAX_MATE_SCORE + ply : td->evalCache.evaluate(b);
     }
 
     // we can also use the tt entry to adjust the evaluation.
-    if (en.zobrist == key >> 32) {
+    if (en.zobrist == verificationKey(key)) {
         // adjusting eval
         if (   (en.type == PV_NODE)
             || (en.type == CUT_NODE && stand_pat < en.score)
@@ -1098,9 +1180,12 @@ Score Search::qSearch(Board* b, Score alpha, Score beta, Depth ply, ThreadData*
             continue;
         if (see + stand_pat > beta + 200)
             return beta;
-        
 
-        b->move<true>(m, table);
+        // the move will be searched. start loading the transposition table entry of the child while
+        // the move is made.
+        table->prefetch(b->keyAfter(m));
+
+        b->move(m);
 
         bool  inCheckOpponent = b->isInCheck(b->getActivePlayer());
 
@@ -1115,7 +1200,7 @@ Score Search::qSearch(Board* b, Score alpha, Score beta, Depth ply, ThreadData*
                 ttNodeType = CUT_NODE;
                 // store the move with higher depth in tt incase the same capture would improve on
                 // beta in ordinary pvSearch too.
-                table->put(key, bestScore, m, ttNodeType, !inCheckOpponent, stand_pat);
+                table->put(key, bestScore, m, ttNodeType, !inCheckOpponent, stand_pat, &td->ttStats);
                 return score;
             }
             if (score > alpha) {
@@ -1127,11 +1212,12 @@ Score Search::qSearch(Board* b, Score alpha, Score beta, Depth ply, ThreadData*
 
     // store the current position inside the transposition table
     if (bestMove)
-        table->put(key, bestScore, bestMove, ttNodeType, 0, stand_pat);
+        table->put(key, bestScore, bestMove, ttNodeType, 0, stand_pat, &td->ttStats);
     return bestScore;
 }
 
 void Search::init(int hashsize) {
+    waitForHash();
     if (table != nullptr)
         delete table;
     table = new TranspositionTable(hashsize);
@@ -1140,15 +1226,63 @@ void Search::init(int hashsize) {
     setThreads(1);
 }
 void Search::cleanUp() {
+    stopPool();
+    waitForHash();
     delete table;
     table = nullptr;
 
     tds.clear();
 }
+/**
+ * picks the thread whose best move is played. Each thread votes for the best move of its last completed
+ * iteration. The vote is weighted by the depth of that iteration and by how much better its score is
+ * than the worst score among all threads. The thread whose move got the most votes is picked unless a
+ * thread found a mate in which case the thread with the best score is picked.
+ * The main thread is used if only one thread searched, multiple lines are analysed or the main thread did
+ * not complete any iteration.
+ * @return
+ */
+ThreadData* Search::bestThread() {
+    ThreadData* best = &tds[0];
+    if (threadCount == 1 || multiPv > 1 || best->completedDepth == 0)
+        return best;
+
+    Score minScore = MAX_MATE_SCORE;
+    for (const ThreadData& td : tds) {
+        if (td.completedDepth > 0)
+            minScore = std::min(minScore, td.completed.score);
+    }
+
+    // sums the votes of all threads for the given move
+    auto votes = [this, minScore](Move m) {
+        S64 total = 0;
+        for (const ThreadData& td : tds) {
+            if (td.completedDepth > 0 && sameMove(td.completed.pv[0], m))
+                total += static_cast<S64>(td.completed.score - minScore + 14) * td.completedDepth;
+        }
+        return total;
+    };
+
+    for (ThreadData& td : tds) {
+        if (td.completedDepth == 0)
+            continue;
+        if (best->completed.score >= MIN_MATE_SCORE || td.completed.score >= MIN_MATE_SCORE) {
+            if (td.completed.score > best->completed.score)
+                best = &td;
+        } else if (votes(td.completed.pv[0]) > votes(best->completed.pv[0])) {
+            best = &td;
+        }
+    }
+    return best;
+}
+void Search::publishNodes(ThreadData* td) {
+    searchedNodes.fetch_add(td->nodes - td->publishedNodes.load(), std::memory_order_relaxed);
+    td->publishedNodes.store(td->nodes);
+}
 U64 Search::totalNodes() const {
     U64 total = 0;
     for (const auto &td : tds) {
-        total += td.nodes;
+        total += td.publishedNodes.load();
     }
     return total;
 }
@@ -1196,7 +1330,25 @@ void           Search::clearHistory() {
         memset(&td.searchData.maxImprovement, 0, 64*64*4);
     }
 }
-void Search::clearHash() { this->table->clear(); }
+template<typename Job>
+void Search::runHashJob(Job job) {
+    std::lock_guard<std::mutex> lock(hashMutex);
+    if (hashThread.joinable())
+        hashThread.join();
+    hashThread = std::thread(job);
+}
+void Search::waitForHash() {
+    std::lock_guard<std::mutex> lock(hashMutex);
+    if (hashThread.joinable())
+        hashThread.join();
+}
+void Search::clearHash() {
+    for (auto &td : tds) {
+        td.ttStats = {};
+        td.evalCache.clear();
+    }
+    runHashJob([this]() { table->clear(threadCount); });
+}
 void Search::setThreads(int threads) {
     int processor_count = static_cast<int>(std::thread::hardware_concurrency());
     if (processor_count == 0)
@@ -1207,23 +1359,221 @@ void Search::setThreads(int threads) {
         threads = 1;
     if (threads > MAX_THREADS)
         threads = MAX_THREADS;
+    // the transposition table might currently be cleared with the old thread count
+    waitForHash();
+    // the threads need to be stopped as they refer to the thread data
+    stopPool();
     threadCount = threads;
     tds.clear();
     for (int i = 0; i < threadCount; i++) {
         tds.emplace_back();
     }
+    startPool();
+}
+int Search::getThreads() const {
+    return threadCount;
+}
+void Search::setHelperDepthSkip(bool enabled) {
+    helperDepthSkip = enabled;
+}
+void Search::setHelperStagger(int stagger) {
+    helperStagger = std::max(0, stagger);
+}
+void Search::setHelperAspirationOffset(int offset) {
+    helperAspirationOffset = std::max(0, offset);
 }
 void Search::setHashSize(int hashSize) {
-    if (table)
-        table->setSize(hashSize);
+    if (!table)
+        return;
+    runHashJob([this, hashSize]() {
+        table->setSize(hashSize, threadCount);
+        printHashBacking();
+    });
+}
+void Search::setHashPageType(mem::PageType type) {
+    if (!table)
+        return;
+    runHashJob([this, type]() {
+        table->setPageType(type, threadCount);
+        printHashBacking();
+    });
+}
+void Search::setHashInterleave(bool interleave) {
+    if (!table)
+        return;
+    runHashJob([this, interleave]() {
+        table->setInterleave(interleave, threadCount);
+        printHashBacking();
+    });
+}
+void Search::printHashBacking() const {
+    std::string info = "info string hash backed by " + mem::toString(table->pageType());
+    if (table->interleaved())
+        info += " interleaved across " + std::to_string(mem::numaNodes()) + " numa nodes";
+    // print the line at once as this might be called from another thread
+    std::cout << info + "\n" << std::flush;
+}
+void Search::printHashLatency() {
+    waitForHash();
+    for (int node = 0; node < mem::numaNodes(); node++) {
+        bool   bound   = false;
+        double latency = 0;
+        // use a new thread so binding does not affect the calling thread
+        std::thread measure([this, node, &bound, &latency]() {
+            bound   = mem::bindToNode(node);
+            latency = table->probeLatency(1 << 20);
+        });
+        measure.join();
+        std::cout << "info string tt latency node " << node << " " << std::fixed << std::setprecision(1)
+                  << latency << " ns" << (bound ? "" : " (thread not bound)") << std::endl;
+    }
+}
+void Search::setHashStats(bool enabled) {
+    this->hashStats = enabled;
+}
+void Search::printHashStats() {
+    waitForHash();
+
+    TTStats stats {};
+    U64     evalProbes = 0;
+    U64     evalHits   = 0;
+    for (const auto &td : tds) {
+        stats += td.ttStats;
+        evalProbes += td.evalCache.probes;
+        evalHits   += td.evalCache.hits;
+    }
+    // sample at most 2^16 buckets to keep this fast for large tables
+    TTOccupancy occ = table->occupancy(1ULL << 16);
+
+    auto percentage = [](U64 part, U64 total) { return total ? 100.0 * part / total : 0.0; };
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    ss << "info string tt size " << table->getSize() << " entries backed by " << mem::toString(table->pageType())
+       << "\n";
+    ss << "info string tt probes " << stats.probes
+       << " hits "                 << stats.hits << " (" << percentage(stats.hits, stats.probes) << "%)"
+       << " collisions "           << stats.collisions << "\n";
+    ss << "info string tt stores " << stats.stores
+       << " empty "                << stats.replacements[REPLACE_EMPTY]
+       << " same "                 << stats.replacements[REPLACE_SAME_POSITION]
+       << " old "                  << stats.replacements[REPLACE_OLD_AGE]
+       << " shallower "            << stats.replacements[REPLACE_SHALLOWER]
+       << " rejected "             << stats.rejected << "\n";
+    ss << "info string tt sampled " << occ.sampled
+       << " used "                  << percentage(occ.used, occ.sampled) << "%"
+       << " current "               << percentage(occ.current, occ.sampled) << "%\n";
+    ss << "info string tt bounds"
+       << " pv "                    << occ.types[PV_NODE]
+       << " cut "                   << occ.types[CUT_NODE]
+       << " all "                   << occ.types[ALL_NODE]
+       << " forced_all "            << occ.types[FORCED_ALL_NODE] << "\n";
+    ss << "info string evalcache probes " << evalProbes
+       << " hits "                        << evalHits << " (" << percentage(evalHits, evalProbes) << "%)\n";
+    ss << "info string tt depths";
+    for (int d = 0; d < 256; d++) {
+        if (occ.depths[d])
+            ss << " " << d << ":" << occ.depths[d];
+    }
+    std::cout << ss.str() << std::endl;
+}
+void Search::saveHash(const std::string& path) {
+    waitForHash();
+    if (table->save(path, nn::networkHash())) {
+        std::cout << "info string saved hash to " << path << std::endl;
+    }
+}
+void Search::loadHash(const std::string& path) {
+    waitForHash();
+    if (table->load(path, nn::networkHash())) {
+        std::cout << "info string loaded hash with " << table->getSize() << " entries from " << path
+                  << std::endl;
+    }
 }
 void Search::setMultiPv(int multiPvCount) {
     this->multiPvDefault = multiPvCount;
 }
+void Search::start(Board* b, TimeManager* timeman, std::function<void(Move)> callback) {
+    waitForSearch();
+    std::lock_guard<std::mutex> lock(poolMutex);
+    // the time manager is set here already so the search can be stopped before thread 0 woke up
+    timeManager = timeman;
+    mainBoard   = b;
+    onBestMove  = std::move(callback);
+    mainRunning = true;
+    mainSearchId++;
+    poolStart.notify_all();
+}
+void Search::waitForSearch() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    poolDone.wait(lock, [this] { return !mainRunning; });
+}
 void Search::stop() {
     if (timeManager)
         timeManager->stopSearch();
 }
+
+/**
+ * starts a thread for each thread data. The threads wait until a search is started.
+ */
+void Search::startPool() {
+    // the threads have not handled any search yet
+    poolExit       = false;
+    mainSearchId   = 0;
+    helperSearchId = 0;
+    for (int i = 0; i < threadCount; i++) {
+        runningThreads.emplace_back(&Search::idleLoop, this, i);
+    }
+}
+
+/**
+ * waits for the search running in the background to finish and stops all threads of the pool.
+ */
+void Search::stopPool() {
+    waitForSearch();
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        poolExit = true;
+        poolStart.notify_all();
+    }
+    for (std::thread& th : runningThreads) {
+        th.join();
+    }
+    runningThreads.clear();
+}
+
+/**
+ * the loop of each thread of the pool. The thread sleeps until a new search is started or the pool is
+ * stopped. Thread 0 runs the searches started in the background, all other threads run as helpers of
+ * the main thread.
+ * @param threadId
+ */
+void Search::idleLoop(int threadId) {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    const U64&                   searchId = threadId == 0 ? mainSearchId : helperSearchId;
+    U64                          handled  = 0;
+    while (true) {
+        poolStart.wait(lock, [&] { return poolExit || searchId != handled; });
+        if (poolExit)
+            return;
+        handled = searchId;
+        lock.unlock();
+
+        if (threadId == 0) {
+            onBestMove(bestMove(mainBoard, timeManager, 0));
+        } else {
+            bestMove(helperBoard, timeManager, threadId);
+        }
+
+        lock.lock();
+        if (threadId == 0) {
+            mainRunning = false;
+        } else {
+            helpersRunning--;
+        }
+        poolDone.notify_all();
+    }
+}
 void Search::printInfoString(Depth depth, int sel_depth, Score score, Move* pv, uint16_t pvLen, int pvIdx) {
 
     if (!printInfo)
@@ -1428,5 +1778,22 @@ Move Search::probeDTZ(Board* board) {
     return 0;
 }
 
+Score EvalCache::evaluate(Board* b) {
+    const U64       zobrist = b->zobrist();
+    EvalCacheEntry& en      = entries[zobrist & (SIZE - 1)];
+    probes++;
+    if (en.key == zobrist >> 32) {
+        hits++;
+        return en.eval;
+    }
+    en.key  = zobrist >> 32;
+    en.eval = b->evaluate();
+    return en.eval;
+}
+void EvalCache::clear() {
+    std::memset(entries, 0, sizeof(entries));
+    probes = 0;
+    hits   = 0;
+}
 ThreadData::ThreadData(int threadId) : threadID(threadId) {}
 ThreadData::ThreadData() {}
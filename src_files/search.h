@@ -28,10 +28,14 @@
 #include "eval.h"
 #include "newmovegen.h"
 
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <ctime>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <stdint.h>
 #include <string>
 #include <tgmath.h>
@@ -40,6 +44,8 @@
 
 #define MAX_THREADS 256
 #define MAX_MULTIPV 256
+// the amount of nodes after which a thread publishes its node count to the other threads
+#define NODE_BATCH  1024
 
 struct RootMove {
     int seldepth;
@@ -57,14 +63,56 @@ struct RootMove {
     }
 };
 
+/**
+ * direct mapped cache for static evaluations. Each thread has its own cache which is small enough
+ * to stay within the L2 cache. Positions which have been replaced in the transposition table can
+ * still be evaluated without running the network.
+ */
+struct EvalCache {
+    // 32768 entries with 8 bytes each -> 256 KB
+    static constexpr int SIZE = 1 << 15;
+
+    struct EvalCacheEntry {
+        bb::U32   key;
+        bb::Score eval;
+    };
+
+    EvalCacheEntry entries[SIZE] {};
+    bb::U64        probes = 0;
+    bb::U64        hits   = 0;
+
+    // returns the cached evaluation of the board. If the board is not cached, its evaluated and stored
+    [[nodiscard]] bb::Score evaluate(Board* b);
+    // removes all entries and resets the counters
+    void clear();
+};
+
+/**
+ * counter which is only written by a single thread but read by others. Relaxed loads and stores are
+ * enough for this and compile to plain moves, so there is no data race without the cost of an atomic
+ * read-modify-write.
+ */
+struct RelaxedCounter {
+    std::atomic<bb::U64> value {0};
+
+    RelaxedCounter() = default;
+    RelaxedCounter(const RelaxedCounter& other) : value(other.load()) {}
+
+    [[nodiscard]] bb::U64 load() const { return value.load(std::memory_order_relaxed); }
+    void                  store(bb::U64 v) { value.store(v, std::memory_order_relaxed); }
+};
+
 /**
  * data about each thread
  */
 struct ThreadData {
     // threadID indicates what thread this data belongs to. threadID = 0 is the mainthread
     int        threadID = 0;
-    // nodes searched by this thread
+    // nodes searched by this thread. This is only accessed by the thread itself
     bb::U64    nodes    = 0;
+    // nodes of this thread which can be read by other threads. Updated every NODE_BATCH nodes and
+    // once the thread finished its search
+    RelaxedCounter publishedNodes {};
     // maximum depth reached in pvsearch / qsearch in this thread
     int        seldepth = 0;
     // amount of tablenbase hits in this thread
@@ -73,6 +121,15 @@ struct ThreadData {
     bool       dropOut  = false;
     // search data which contains additional information like history tables etc
     SearchData searchData {};
+    // statistics about the usage of the transposition table by this thread
+    TTStats    ttStats {};
+    // cache for static evaluations
+    EvalCache  evalCache {};
+    // table to refresh the accumulators after king moves. It persists across searches and is only
+    // reset if the network changes
+    nn::AccumulatorTable accumulatorTable {};
+    // accumulators used by the board searched by this thread
+    nn::AccumulatorStack accumulatorStack {};
     // move generators to not reallocate
     moveGen    generators[bb::MAX_INTERNAL_PLY] {};
     
@@ -88,6 +145,10 @@ struct ThreadData {
     RootMove   rootMoves[256];
     uint16_t   rootMoveCount;
 
+    // the best root move of the last iteration completed by this thread. Used to pick the best thread
+    bb::Depth  completedDepth = 0;
+    RootMove   completed {};
+
     ThreadData();
 
     explicit ThreadData(int threadId);
@@ -121,8 +182,33 @@ class Search {
     // the search keeps a reference to the time manager which tells the search when
     // to stop the search based on enabled limits like node-limits, time-limits and depth-limits.
     TimeManager* timeManager;
-    // if smp is enabled (threadCount > 1), we need to keep track of all the threads spawned
+    // the threads are kept alive between searches and wait on poolStart until a search is started.
+    // thread 0 runs the searches started in the background (see start), the other threads are the
+    // helpers of the main thread if smp is enabled (threadCount > 1)
     std::vector<std::thread> runningThreads;
+    std::mutex               poolMutex;
+    std::condition_variable  poolStart;
+    std::condition_variable  poolDone;
+    bool                     poolExit = false;
+    // each search started in the background and each start of the helpers gets a new id. The threads
+    // compare it to the last id they handled to know if there is a new search
+    bb::U64                  mainSearchId   = 0;
+    bb::U64                  helperSearchId = 0;
+    // tracks if the threads are still searching
+    bool                     mainRunning    = false;
+    int                      helpersRunning = 0;
+    // sum of the nodes published by all threads. Used to enforce node limits across all threads
+    std::atomic<bb::U64>     searchedNodes  {0};
+    // helper threads are diversified so they do not search the same trees as the main thread. They skip
+    // some depths of the iterative deepening, start at different depths and use wider aspiration windows
+    bool                     helperDepthSkip        = true;
+    int                      helperStagger          = 2;
+    int                      helperAspirationOffset = 5;
+    // the root positions for the searches and the callback which receives the best move of a search
+    // started in the background
+    Board*                   mainBoard   = nullptr;
+    Board*                   helperBoard = nullptr;
+    std::function<void(move::Move)> onBestMove;
     // beside storing each thread, we need to also track the data per thread
     std::vector<ThreadData> tds;
     // if specified below, the search will attempt to use tablebases
@@ -130,6 +216,12 @@ class Search {
     bool useTB = false;
     // printInfo specifies if uci strings shall be displayed or not
     bool printInfo = true;
+    // print statistics about the transposition table after each search
+    bool hashStats = false;
+    // resizing and clearing the transposition table is done in the background. The job is run by
+    // hashThread and hashMutex protects starting and joining the job
+    std::thread hashThread;
+    std::mutex  hashMutex;
 
     public:
     // initialise the search including the transposition table
@@ -138,6 +230,12 @@ class Search {
     void cleanUp();
 
     private:
+    // returns the thread whose result is used once the search finished
+    [[nodiscard]] ThreadData* bestThread();
+
+    // makes the nodes searched by the thread visible to other threads
+    void publishNodes(ThreadData* td);
+
     // functions internally used to compute node counts, seldepth and tbhits across all threads
     [[nodiscard]] bb::U64 totalNodes() const;
     [[nodiscard]] int     selDepth() const;
@@ -146,6 +244,16 @@ class Search {
     // function to compute get all the legal moves for the board
     [[nodiscard]] move::MoveList legals(Board* board) const;
 
+    // starts / stops the threads of the pool
+    void startPool();
+    void stopPool();
+    // the loop run by each thread of the pool. Waits until a search is started and runs it
+    void idleLoop(int threadId);
+
+    // runs the given job on the transposition table in the background once the previous job finished
+    template<typename Job>
+    void runHashJob(Job job);
+
     public:
     // returns the overview of the latest search
     [[nodiscard]] SearchOverview overview() const;
@@ -157,15 +265,43 @@ class Search {
     void useTableBase(bool val);
     // clears history tables
     void clearHistory();
-    // clears transposition table
+    // clears transposition table in the background
     void clearHash();
+    // waits until the transposition table can be used again after it has been resized or cleared
+    void waitForHash();
     // sets threads to be used for smp
     void setThreads(int threads);
-    // set the hash size for the transposition table
+    // returns the amount of threads used for smp
+    [[nodiscard]] int getThreads() const;
+    // set the hash size for the transposition table. This is done in the background
     void setHashSize(int hashSize);
+    // set the type of pages used for the transposition table. This is done in the background
+    void setHashPageType(mem::PageType type);
+    // interleave the transposition table across numa nodes. This is done in the background
+    void setHashInterleave(bool interleave);
+    // prints the memory backing the transposition table
+    void printHashBacking() const;
+    // prints the latency of probing the transposition table from each numa node
+    void printHashLatency();
+    // enable / disable printing statistics about the transposition table after each search
+    void setHashStats(bool enabled);
+    // prints statistics about the transposition table
+    void printHashStats();
+    // saves / loads the transposition table to / from a file
+    void saveHash(const std::string& path);
+    void loadHash(const std::string& path);
+    // configures how helper threads are diversified: skipping depths, staggering the start depth across
+    // stagger + 1 depths and adding the offset to the aspiration window for each helper (see bestMove)
+    void setHelperDepthSkip(bool enabled);
+    void setHelperStagger(int stagger);
+    void setHelperAspirationOffset(int offset);
     // sets the amount of lines to analyse
     void setMultiPv(int multiPvCount);
     
+    // starts the search in the background. The best move is passed to the callback once the search finished
+    void start(Board* b, TimeManager* timeManager, std::function<void(move::Move)> callback);
+    // waits until the search running in the background finished
+    void waitForSearch();
     // stops the search
     void stop();
 
@@ -76,7 +76,7 @@ void TimeManager::setMatchTimeLimit (S64 time, S64 inc, int moves_to_go) {
 
 void TimeManager::reset() {
     this->setStartTime();
-    this->force_stop       = false;
+    this->force_stop.store(false, std::memory_order_relaxed);
     this->depth_limit      = {};
     this->node_limit       = {};
     this->move_time_limit  = {};
@@ -104,17 +104,17 @@ void TimeManager::setMoveOverheadType(MoveOverheadType mode) {
 }
 
 void TimeManager::stopSearch() {
-    force_stop = true;
+    force_stop.store(true, std::memory_order_relaxed);
 }
 
-bool TimeManager::isTimeLeft(SearchData* sd) const {
-    // stop the search if requested
-    if (force_stop)
-        return false;
+void TimeManager::checkTime(SearchData* sd) {
+    // no need to read the clock if there is no time limit
+    if (!this->move_time_limit.enabled)
+        return;
     
     U64 elapsed = elapsedTime();
     
-    if (sd != nullptr && this->match_time_limit.enabled) {
+    if (this->match_time_limit.enabled) {
         if (elapsed * 10 < this->match_time_limit.time_to_use) {
             sd->targetReached = false;
         } else {
@@ -122,6 +122,18 @@ bool TimeManager::isTimeLeft(SearchData* sd) const {
         }
     }
     
+    // if we are above the maximum allowed time, stop
+    if (this->move_time_limit.upper_time_bound < elapsed)
+        stopSearch();
+}
+
+bool TimeManager::isTimeLeft() const {
+    // stop the search if requested
+    if (isStopped())
+        return false;
+    
+    U64 elapsed = elapsedTime();
+    
     // if we are above the maximum allowed time, stope
     if (    this->move_time_limit.enabled
          && this->move_time_limit.upper_time_bound < elapsed)
@@ -132,7 +144,7 @@ bool TimeManager::isTimeLeft(SearchData* sd) const {
 
 bool TimeManager::rootTimeLeft(int nodeScore, int evalScore) const {
     // stop the search if requested
-    if (force_stop)
+    if (isStopped())
         return false;
 
     nodeScore = 110 - std::min(nodeScore, 90);
@@ -25,6 +25,8 @@
 #include "history.h"
 #include "move.h"
 
+#include <atomic>
+
 
 struct Limit {
     bool enabled = false;
@@ -67,7 +69,8 @@ class TimeManager {
     // move overhead
     MoveOverhead   move_overhead    {};
 
-    bool           force_stop       {};
+    // set once the search should stop. Its read at every node so only relaxed loads should be used
+    std::atomic<bool> force_stop    {};
     bb::S64        start_time       {};
 
     TimeManager();
@@ -116,9 +119,20 @@ class TimeManager {
     void stopSearch();
 
     /**
-     * returns true if there is enough time left. This is used by the principal variation search.
+     * returns true if the search has been stopped. This is cheap enough to be checked at every node
+     */
+    [[nodiscard]] inline bool isStopped() const { return force_stop.load(std::memory_order_relaxed); }
+
+    /**
+     * polls the clock and stops the search if the time is over. This is used by the principal variation
+     * search every few nodes instead of reading the clock at each node.
+     */
+    void checkTime(SearchData* sd);
+
+    /**
+     * returns true if there is enough time left.
      */
-    [[nodiscard]] bool isTimeLeft(SearchData* sd = nullptr) const;
+    [[nodiscard]] bool isTimeLeft() const;
 
     /**
      * returns true if there is enough root time. root time is used to increase the depth in between
@@ -19,29 +19,70 @@
 
 #include "transpositiontable.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
 
 /**
- * inits the table to the given size.
- * Calculates the amount of entries that can fit.
- * @param MB
+ * maps the key to a bucket. Instead of using the lower bits of the key (which requires the size to
+ * be a power of 2), the key is multiplied with the size and the upper 64 bits of the product are
+ * used. This way, any size can be used and the index only depends on the upper bits of the key.
+ * @param zobrist
+ * @return
  */
-void TranspositionTable::init(bb::U64 MB) {
-    bb::U64 bytes      = MB * 1024 * 1024;
-    bb::U64 maxEntries = bytes / sizeof(Entry);
+inline bb::U64 TranspositionTable::index(bb::U64 zobrist) const {
+    return (static_cast<unsigned __int128>(zobrist) * m_size) >> 64;
+}
 
-    // size must be a power of 2!
-    m_size = 1;
+/**
+ * returns the upper 6 bits of the lower half of the product computed in index. They describe
+ * where the key lies within the range of keys which are mapped to the bucket.
+ * @param zobrist
+ * @return
+ */
+int TranspositionTable::fraction(bb::U64 zobrist) const {
+    return static_cast<bb::U64>(static_cast<unsigned __int128>(zobrist) * m_size) >> 58;
+}
 
-    while (m_size <= maxEntries) {
-        m_size *= 2;
-    }
+/**
+ * the worth of an entry used for replacement decisions. Empty entries are worth the least. The worth
+ * of an entry decreases with the amount of searches since it has been written.
+ * @param entry
+ * @return
+ */
+int TranspositionTable::worth(const Entry& entry) const {
+    if (!entry.key())
+        return INT32_MIN;
+    const int age = (m_currentAge - entry.age + AGE_COUNT) % AGE_COUNT;
+    return entry.depth - 8 * age;
+}
 
-    m_size /= 2;
-    m_mask = m_size - 1;
+/**
+ * inits the table to the given size.
+ * Calculates the amount of buckets that can fit.
+ * @param MB
+ * @param threads   the amount of threads used to clear the table
+ */
+void TranspositionTable::init(bb::U64 MB, int threads) {
+    mem::freeLarge(m_buckets, sizeof(Bucket) * m_size, m_pages);
+    m_buckets = nullptr;
 
-    m_entries = std::make_unique<Entry[]>(m_size);
-    clear();
+    // the size does not need to be a power of 2 as the index is computed using a multiplication
+    // (see index)
+    m_size = std::max((bb::U64) 1, MB * 1024 * 1024 / sizeof(Bucket));
+
+    m_buckets = static_cast<Bucket*>(mem::allocLarge(sizeof(Bucket) * m_size, m_requestedPages, m_pages));
+    if (m_buckets == nullptr)
+        throw std::bad_alloc();
+    // the memory policy needs to be set before clearing the table touches the pages
+    m_interleaved = m_interleave && mem::interleave(m_buckets, sizeof(Bucket) * m_size);
+    clear(threads);
 
     m_currentAge = 0;
 }
@@ -50,124 +91,458 @@ void TranspositionTable::init(bb::U64 MB) {
  * returns the maximum amount of entries that can be stored.
  * @return
  */
-bb::U64 TranspositionTable::getSize() const { return m_size; }
+bb::U64 TranspositionTable::getSize() const { return m_size * BUCKET_SIZE; }
 
 /**
  * constructor which inits the table with a maximum size given by mb.
  * @param mb
  */
-TranspositionTable::TranspositionTable(bb::U64 mb) { init(mb); }
+TranspositionTable::TranspositionTable(bb::U64 mb) { init(mb, 1); }
+
+TranspositionTable::~TranspositionTable() { mem::freeLarge(m_buckets, sizeof(Bucket) * m_size, m_pages); }
 
 /**
- * clears the content and enlarges the table if possibles to a maximum size of mb
+ * changes the size of the table to mb. The entries of the current table are moved into the new
+ * table (see rehash) so the content is not lost.
  * @param mb
+ * @param threads   the amount of threads used to clear and fill the new table
+ */
+void TranspositionTable::setSize(bb::U64 mb, int threads) {
+    if (!m_buckets) {
+        init(mb, threads);
+        return;
+    }
+
+    Bucket*             oldBuckets = m_buckets;
+    const bb::U64       oldSize    = m_size;
+    const mem::PageType oldPages   = m_pages;
+    const NodeAge       age        = m_currentAge;
+
+    // allocate a new table while keeping the old one
+    m_buckets = nullptr;
+    init(mb, threads);
+    m_currentAge = age;
+
+    rehash(oldBuckets, oldSize, threads);
+    mem::freeLarge(oldBuckets, sizeof(Bucket) * oldSize, oldPages);
+}
+
+/**
+ * moves the entries of the old table into this table. The position of each key is restored from
+ * the index of the old bucket and the fraction stored within the bucket. The fraction is only an
+ * approximation if the entry has been written by multiple threads at the same time (see Bucket).
+ * If there are more entries for a bucket than it can hold, entries of the current search and with
+ * the highest depth are kept.
+ * This table is split into equally sized chunks which are filled by separate threads. Each thread
+ * only reads the old buckets which map to its chunk so no bucket is written by multiple threads.
+ * @param oldBuckets
+ * @param oldSize
+ * @param threads
+ */
+void TranspositionTable::rehash(const Bucket* oldBuckets, bb::U64 oldSize, int threads) {
+    using U128 = unsigned __int128;
+
+    threads = std::max(1, threads);
+
+    const bb::U64            chunk = (m_size + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        const bb::U64 start = std::min(m_size, chunk * t);
+        const bb::U64 end   = std::min(m_size, start + chunk);
+        workers.emplace_back([this, oldBuckets, oldSize, start, end]() {
+            // the old buckets which may contain entries for [start, end)
+            const bb::U64 first = static_cast<U128>(start) * oldSize / m_size;
+            const bb::U64 last  = std::min<bb::U64>(oldSize, static_cast<U128>(end) * oldSize / m_size + 1);
+
+            for (bb::U64 i = first; i < last; i++) {
+                for (int e = 0; e < BUCKET_SIZE; e++) {
+                    const Entry& en = oldBuckets[i].entries[e];
+                    if (!en.key())
+                        continue;
+
+                    // position of the key in units of 1/128 buckets. we use the center of the
+                    // fraction as the exact position is unknown
+                    const U128    pos   = (static_cast<U128>(i * 64 + oldBuckets[i].fraction(e)) * 2 + 1)
+                                        * m_size / oldSize;
+                    const bb::U64 idx   = pos / 128;
+                    if (idx < start || idx >= end)
+                        continue;
+
+                    // replace the least valuable entry if the new entry is worth more
+                    Bucket& b    = m_buckets[idx];
+                    int     slot = 0;
+                    for (int s = 1; s < BUCKET_SIZE; s++) {
+                        if (worth(b.entries[s]) < worth(b.entries[slot]))
+                            slot = s;
+                    }
+                    if (worth(en) > worth(b.entries[slot])) {
+                        b.entries[slot] = en;
+                        b.setFraction(slot, (pos % 128) / 2);
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * sets the type of pages which shall be used to back the table. The table is reallocated with the
+ * same size and its entries are moved into the new memory. If the requested page type is not
+ * available, it falls back to smaller pages.
+ * @param type
+ * @param threads   the amount of threads used to clear the table
+ */
+void TranspositionTable::setPageType(mem::PageType type, int threads) {
+    m_requestedPages = type;
+    setSize(sizeof(Bucket) * m_size / (1024 * 1024), threads);
+}
+
+/**
+ * returns the type of pages which actually back the table.
+ * @return
+ */
+mem::PageType TranspositionTable::pageType() const { return m_pages; }
+
+/**
+ * sets if the pages of the table shall be interleaved across all numa nodes. By default, the
+ * pages are placed on the node of the thread which touches them first. The table is reallocated
+ * and its entries are moved into the new memory.
+ * @param interleave
+ * @param threads   the amount of threads used to clear and fill the new table
+ */
+void TranspositionTable::setInterleave(bool interleave, int threads) {
+    m_interleave = interleave;
+    setSize(sizeof(Bucket) * m_size / (1024 * 1024), threads);
+}
+
+/**
+ * returns true if the pages of the table are interleaved across multiple numa nodes.
+ * @return
+ */
+bool TranspositionTable::interleaved() const { return m_interleaved; }
+
+/**
+ * measures the average latency of a probe in nanoseconds. Each key depends on the result of the
+ * previous probe so the memory accesses cannot overlap.
+ * @param probes
+ * @return
  */
-void TranspositionTable::setSize(bb::U64 mb) {
-    init(mb);
+double TranspositionTable::probeLatency(int probes) const {
+    bb::U64    key   = 0x9E3779B97F4A7C15ULL;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < probes; i++) {
+        const Entry en = get(key);
+        key            = (key ^ en.zobrist ^ en.move) * 0xD1342543DE82EF95ULL + 1;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    // use the key so the loop is not optimised away
+    return std::chrono::duration<double, std::nano>(end - start).count() / probes + (key == 0);
 }
 
 /**
  * clears the content and sets all entries to 0.
+ * The table is split into equally sized chunks which are cleared by the given amount of threads.
+ * Besides being faster for large tables, this also causes the pages to be touched first by the
+ * threads which will later access them which distributes the memory across numa nodes.
+ * @param threads
  */
-void TranspositionTable::clear() {
-    if (m_entries)
-        std::memset(m_entries.get(), 0, sizeof(Entry) * m_size);
+void TranspositionTable::clear(int threads) {
+    if (!m_buckets)
+        return;
+
+    threads = std::max(1, threads);
+
+    const bb::U64            chunk = (m_size + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        const bb::U64 start = std::min(m_size, chunk * i);
+        const bb::U64 end   = std::min(m_size, start + chunk);
+        workers.emplace_back(
+            [this, start, end]() { std::memset(m_buckets + start, 0, sizeof(Bucket) * (end - start)); });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
 }
 
 /**
- * returns a floating value for the amount of values used.
+ * returns a floating value for the amount of values used by the current search.
  * if it returns 0, no value is stored and if it returns 1, it is full.
+ * Entries from previous searches are considered free as they will be replaced first.
  */
 double TranspositionTable::usage() const {
-    double used = 0;
     // Thank you Andrew for this idea :)
-    for (bb::U64 i = 0; i < 100; i++) {
-        if ((m_entries[i].zobrist)) {
-            used++;
+    // sample the first 1000 entries (200 buckets)
+    const bb::U64 buckets = std::min(m_size, (bb::U64) 1000 / BUCKET_SIZE);
+    double        used    = 0;
+    for (bb::U64 i = 0; i < buckets; i++) {
+        for (const Entry& en : m_buckets[i].entries) {
+            if (en.key() && en.age == m_currentAge) {
+                used++;
+            }
         }
     }
 
-    return used / 100;
+    return used / (buckets * BUCKET_SIZE);
+}
+
+/**
+ * computes the occupancy of the table based on the first buckets. The amount of entries is
+ * collected per node type and per depth.
+ * @param buckets   the maximum amount of buckets to sample
+ * @return
+ */
+TTOccupancy TranspositionTable::occupancy(bb::U64 buckets) const {
+    TTOccupancy res {};
+    buckets = std::min(m_size, buckets);
+    for (bb::U64 i = 0; i < buckets; i++) {
+        for (const Entry& en : m_buckets[i].entries) {
+            res.sampled++;
+            if (!en.key())
+                continue;
+            res.used++;
+            res.current += en.age == m_currentAge;
+            res.types [en.type]++;
+            res.depths[static_cast<uint8_t>(en.depth)]++;
+        }
+    }
+    return res;
+}
+
+/**
+ * adds the counters of another thread to these counters.
+ * @param other
+ * @return
+ */
+TTStats& TTStats::operator+=(const TTStats& other) {
+    probes     += other.probes;
+    hits       += other.hits;
+    collisions += other.collisions;
+    stores     += other.stores;
+    rejected   += other.rejected;
+    for (int i = 0; i < REPLACEMENT_REASONS; i++) {
+        replacements[i] += other.replacements[i];
+    }
+    return *this;
 }
 
 /**
  * returns the Entry for the given key.
- * if there is no Entry found, it returns a nullptr.
+ * if there is no Entry found, an empty entry with a zero key is returned. The zobrist field of the
+ * returned entry contains the plain key (not xor-ed with the data).
  * @param zobrist
+ * @param stats     counters to update, may be nullptr
  * @return
  */
-Entry TranspositionTable::get(bb::U64 zobrist) const {
-    bb::U64 index = zobrist & m_mask;
+Entry TranspositionTable::get(bb::U64 zobrist, TTStats* stats) const {
+    bb::U32       key   = verificationKey(zobrist);
+    const Bucket& b     = m_buckets[index(zobrist)];
 
-    Entry enP = m_entries[index];
+    if (stats)
+        stats->probes++;
 
-    return enP;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        // copy the entry first so the check and the returned data are based on the same content
+        Entry en = b.entries[i];
+        if (en.key() == key) {
+            en.zobrist = key;
+            if (stats)
+                stats->hits++;
+            return en;
+        }
+    }
+
+    return Entry {};
 }
 
 /**
- * puts the given Score, Move, NodeType, Depth into the table if possible.
- * if there is already a value, it will only override if the following is fulfilled:
+ * puts the given Score, Move, NodeType, Depth into the bucket of the given key.
+ * If the position is already stored within the bucket, it will only override the entry if the
+ * following is fulfilled:
  *  - a non-pv value cannot override a pv value
  *  - a pv node will always override a pv node
  *  - a non-pv value will only override a non-pv value if the oldDepth <= newDepth
  *
+ * If the position has not been stored yet, the least valuable entry of the bucket is replaced.
+ * Empty entries come first, followed by entries from older searches and entries with a low depth.
  *
  * @param zobrist
  * @param score
  * @param move
  * @param type
  * @param depth
+ * @param eval
+ * @param stats     counters to update, may be nullptr
  * @return
  */
 bool TranspositionTable::put(bb::U64 zobrist, bb::Score score, move::Move move, NodeType type,
-                             bb::Depth depth, bb::Score eval) {
-    bb::U64 index  = zobrist & m_mask;
-    Entry* enP = &m_entries[index];
-    bb::U32 key    = zobrist >> 32;
-
-    if (enP->zobrist == 0) {
-        enP->set(key, score, move, type, depth, eval);
-        enP->setAge(m_currentAge);
-        return true;
-    } else {
-        //  on enP->depth < depth * 2:
-        //  The idea behind this replacement scheme is to allow faster searches of subtrees by
-        //  allowing more localized search results to be stored in the TT. A hard replacement scheme
-        //  has been tested on another engine, and has been shown to be worse (there is a limit to how
-        //  great of a depth override should occur).
-
-        //  This idea of replacement can be found in many strong engines (SF and Ethereal), however
-        //  they use a static margin. Martin (author of Cheng) tested and validated a variable margin.
-        if (   enP->getAge() != m_currentAge
-            || type == PV_NODE
-            || (enP->type    != PV_NODE && enP->depth <= depth)
-            || (enP->zobrist == key     && enP->depth <= depth * 2)) {
-            enP->set(key, score, move, type, depth, eval);
-            enP->setAge(m_currentAge);
-            return true;
+                             bb::Depth depth, bb::Score eval, TTStats* stats) {
+    bb::U32 key     = verificationKey(zobrist);
+    Bucket& b       = m_buckets[index(zobrist)];
+    Entry*  enP     = &b.entries[0];
+    int     enWorth = INT32_MAX;
+
+    for (Entry& en : b.entries) {
+        // the position is already stored within this bucket
+        const bb::U32 enKey = en.key();
+        if (enKey == key) {
+            enP = &en;
+            break;
+        }
+
+        const int enW = worth(en);
+        if (enW < enWorth) {
+            enP     = &en;
+            enWorth = enW;
+        }
+    }
+
+    if (stats)
+        stats->stores++;
+
+    const bb::U32 enKey = enP->key();
+    if (enKey != key) {
+        if (stats) {
+            stats->replacements[!enKey                      ? REPLACE_EMPTY
+                                : enP->age != m_currentAge ? REPLACE_OLD_AGE
+                                                            : REPLACE_SHALLOWER]++;
         }
+        enP->set(key, score, move, type, depth, eval, m_currentAge);
+        b.setFraction(enP - b.entries, fraction(zobrist));
+        return true;
+    }
+
+    //  on enP->depth < depth * 2:
+    //  The idea behind this replacement scheme is to allow faster searches of subtrees by
+    //  allowing more localized search results to be stored in the TT. A hard replacement scheme
+    //  has been tested on another engine, and has been shown to be worse (there is a limit to how
+    //  great of a depth override should occur).
+
+    //  This idea of replacement can be found in many strong engines (SF and Ethereal), however
+    //  they use a static margin. Martin (author of Cheng) tested and validated a variable margin.
+    if (   enP->age  != m_currentAge
+        || type      == PV_NODE
+        || (enP->type != PV_NODE && enP->depth <= depth)
+        || enP->depth <= depth * 2) {
+        if (stats)
+            stats->replacements[REPLACE_SAME_POSITION]++;
+        enP->set(key, score, move, type, depth, eval, m_currentAge);
+        b.setFraction(enP - b.entries, fraction(zobrist));
+        return true;
     }
 
+    if (stats)
+        stats->rejected++;
     return false;
 }
 
+/**
+ * creates the header which describes the current table.
+ */
+static TTFileHeader fileHeader(bb::U64 network, bb::U64 buckets, NodeAge age) {
+    TTFileHeader header {};
+    std::memcpy(header.magic, "KOIVTT01", sizeof(header.magic));
+    header.version    = MAJOR_VERSION * 1000 + MINOR_VERSION;
+    header.network    = network;
+    header.bucketSize = sizeof(Bucket);
+    header.buckets    = buckets;
+    header.age        = age;
+    return header;
+}
+
+/**
+ * writes the table including a header into the given file. The file is first written to a
+ * temporary file and renamed afterwards so a table which has been loaded from the same file
+ * remains valid.
+ * @param path
+ * @param network   the hash of the network used to compute the entries
+ * @return          true if the table has been saved
+ */
+bool TranspositionTable::save(const std::string& path, bb::U64 network) const {
+    const std::string tmp = path + ".tmp";
+    std::ofstream     file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cout << "info string could not open " << tmp << std::endl;
+        return false;
+    }
+
+    char               page[TT_FILE_HEADER_SIZE] {};
+    const TTFileHeader header = fileHeader(network, m_size, m_currentAge);
+    std::memcpy(page, &header, sizeof(header));
+    file.write(page, sizeof(page));
+    file.write(reinterpret_cast<const char*>(m_buckets), sizeof(Bucket) * m_size);
+    file.close();
+
+    if (!file || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "info string could not write " << path << std::endl;
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * loads a table which has been saved using save. The file is mapped into memory so only the
+ * accessed parts are read. The table is rejected if it has been created by another version or
+ * with another network. In that case, the current table remains unchanged.
+ * @param path
+ * @param network   the hash of the network currently used
+ * @return          true if the table has been loaded
+ */
+bool TranspositionTable::load(const std::string& path, bb::U64 network) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "info string could not open " << path << std::endl;
+        return false;
+    }
+    const bb::U64 fileSize = file.tellg();
+
+    TTFileHeader header {};
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    const TTFileHeader expected = fileHeader(network, header.buckets, header.age);
+    if (!file || std::memcmp(&header, &expected, sizeof(header)) != 0 || header.age >= AGE_COUNT
+        || header.buckets == 0
+        || fileSize != TT_FILE_HEADER_SIZE + sizeof(Bucket) * header.buckets) {
+        std::cout << "info string rejected " << path << " (other version, network or corrupted)" << std::endl;
+        return false;
+    }
+
+    mem::PageType pages;
+    Bucket*       buckets = static_cast<Bucket*>(
+        mem::mapFile(path, TT_FILE_HEADER_SIZE, sizeof(Bucket) * header.buckets, pages));
+    if (buckets == nullptr) {
+        std::cout << "info string could not read " << path << std::endl;
+        return false;
+    }
+
+    mem::freeLarge(m_buckets, sizeof(Bucket) * m_size, m_pages);
+    m_buckets     = buckets;
+    m_pages       = pages;
+    m_interleaved = false;
+    m_size        = header.buckets;
+    m_currentAge  = header.age;
+    return true;
+}
+
 /**
  * Increments the age of the transposition table.
- * To avoid overflowing as only 8 bits are used, we wrap at 255 and go back to 0.
+ * As only 5 bits are used, the age wraps at AGE_COUNT and goes back to 0.
  */
 void TranspositionTable::incrementAge() {
-    TranspositionTable::m_currentAge++;
-    if (TranspositionTable::m_currentAge == 255) {
-        TranspositionTable::m_currentAge = 0;
-    }
+    m_currentAge = (m_currentAge + 1) % AGE_COUNT;
 }
 
 void TranspositionTable::prefetch(const bb::U64 zobrist) const {
-    __builtin_prefetch(&m_entries[zobrist & m_mask]);
+    __builtin_prefetch(&m_buckets[index(zobrist)]);
 }
 
 /**
  * returns the maximum TT size in MB
  * @return
  */
-int maxTTSize() { return (bb::ONE << (32 - 20)) * sizeof(Entry); }
+int maxTTSize() { return (bb::ONE << 32) * sizeof(Bucket) / (1024 * 1024); }
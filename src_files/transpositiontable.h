@@ -21,11 +21,14 @@
 #define CHESSCOMPUTER_HASHMAP_H
 
 #include "bitboard.h"
+#include "memory.h"
 #include "move.h"
 
+#include <cstring>
 #include <memory>
 #include <ostream>
 #include <stdint.h>
+#include <string>
 
 using NodeType = uint8_t;
 using NodeAge = uint8_t;
@@ -36,71 +39,203 @@ constexpr NodeType ALL_NODE = 2;
 constexpr NodeType FORCED_ALL_NODE = 3;
 constexpr NodeType FORMER_CUT_NODE = 6;
 
-struct Entry {
-    //    Entry() = default;
-    //    ~Entry() = default;
+// ages are stored with 5 bits next to the node type. the age therefor wraps at 32.
+constexpr NodeAge AGE_COUNT = 32;
 
+struct Entry {
     friend std::ostream& operator<<(std::ostream& os, const Entry& entry) {
         os << "zobrist: " << entry.zobrist << " move: " << entry.move << " depth: " << static_cast<int>(entry.depth)
-           << " type: " << static_cast<int>(entry.type) << " score: " << entry.score;
+           << " type: " << static_cast<int>(entry.type) << " score: " << entry.score
+           << " age: " << static_cast<int>(entry.age);
         return os;
     }
 
-    void set(bb::U32 p_key, bb::Score p_score, move::Move p_move, NodeType p_type, bb::Depth p_depth, bb::Score p_eval) {
-        this->zobrist = p_key;
+    void set(bb::U32 p_key, bb::Score p_score, move::Move p_move, NodeType p_type, bb::Depth p_depth, bb::Score p_eval,
+             NodeAge p_age) {
         this->score   = p_score;
-        this->move    = p_move;
+        this->move    = move::compress(p_move);
         this->type    = p_type;
         this->depth   = p_depth;
         this->eval    = p_eval;
+        this->age     = p_age;
+        this->zobrist = p_key ^ checksum();
+    }
+
+    // the key is stored xor-ed with the remaining 64 bits of the entry. Multiple threads access the
+    // table without any locking so an entry may be read while another thread is writing it. Such
+    // torn entries will not reproduce the key and are therefore not trusted.
+    [[nodiscard]] bb::U32 checksum() const {
+        bb::U64 data;
+        std::memcpy(&data, reinterpret_cast<const char*>(this) + sizeof(zobrist), sizeof(data));
+        return static_cast<bb::U32>(data ^ (data >> 32));
+    }
+
+    // returns the key of the position stored within this entry. 0 if the entry is empty
+    [[nodiscard]] bb::U32 key() const { return zobrist ^ checksum(); }
+
+    bb::U32           zobrist;     // 32 bit
+    move::CompactMove move;        // 16 bit
+    bb::Score         score;       // 16 bit
+    bb::Score         eval;        // 16 bit
+    bb::Depth         depth;       // 8 bit
+    NodeType          type : 3;    // 3 bit
+    NodeAge           age  : 5;    // 5 bit -> 96 bit = 12 byte
+};
+
+// the table is split into buckets which each fill a single cache line. a position is mapped to a
+// bucket and may be stored in any of its entries. this way, a collision does not necessarily evict
+// useful information and a probe only touches a single cache line.
+constexpr int BUCKET_SIZE = 5;
+
+// besides the entries, each bucket stores 6 bits per entry describing where the key of the entry
+// lies within the range of keys mapped to the bucket (see TranspositionTable::fraction). The key
+// itself only contains the lower bits which are not used for indexing. The fraction allows the
+// entries to be moved into a table of a different size without clearing it.
+// All fractions share a single word while threads may write different entries of the same bucket at
+// the same time. The word is therefore updated atomically so the fraction of another entry is never
+// lost. If two threads write the same entry at the same time, the fraction may still belong to the
+// other position. Such an entry is only moved into another bucket within the range of its old bucket
+// where it is not found anymore, similar to a torn entry.
+struct Bucket {
+    Entry   entries[BUCKET_SIZE];     // 480 bit
+    bb::U32 fractions;                //  32 bit -> 512 bit = 64 byte
+
+    [[nodiscard]] int fraction(int entry) const { return (fractions >> (6 * entry)) & 63; }
+
+    void setFraction(int entry, int fraction) {
+        const bb::U32 mask     = 63U << (6 * entry);
+        const bb::U32 value    = static_cast<bb::U32>(fraction) << (6 * entry);
+        bb::U32       expected = __atomic_load_n(&fractions, __ATOMIC_RELAXED);
+        // updates of the same position do not change the fraction and do not need to lock the bucket
+        while ((expected & mask) != value
+               && !__atomic_compare_exchange_n(&fractions, &expected, (expected & ~mask) | value, true,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
     }
+} __attribute__((aligned(64)));
+
+static_assert(sizeof(Entry ) == 12);
+static_assert(sizeof(Bucket) == 64);
+
+// reasons for put to write an entry
+enum ReplacementReason {
+    REPLACE_EMPTY,            // an empty slot has been used
+    REPLACE_SAME_POSITION,    // the entry of the same position has been updated
+    REPLACE_OLD_AGE,          // an entry of another position from a previous search has been evicted
+    REPLACE_SHALLOWER,        // an entry of another position from the current search has been evicted
+    REPLACEMENT_REASONS,
+};
 
-    [[nodiscard]] NodeAge getAge() const { return move::getScore(move); }
+// counters about probing and storing. Each search thread has its own counters so collecting the
+// statistics does not cause any additional writes to shared memory.
+struct TTStats {
+    bb::U64 probes;
+    bb::U64 hits;
+    // hits where the stored move cannot be played in the position (detected key collisions)
+    bb::U64 collisions;
+    bb::U64 stores;
+    // stores of an already existing position which have not been written due to the replacement scheme
+    bb::U64 rejected;
+    bb::U64 replacements[REPLACEMENT_REASONS];
+
+    TTStats& operator+=(const TTStats& other);
+};
 
-    void setAge(NodeAge p_age) { move::setScore(move, p_age); }
+// the content of the table based on a sample of buckets
+struct TTOccupancy {
+    bb::U64 sampled;
+    bb::U64 used;
+    // entries written during the current search
+    bb::U64 current;
+    bb::U64 types [8];
+    bb::U64 depths[256];
+};
 
-    bb::U32     zobrist;    // 32 bit
-    move::Move  move;       // 32 bit  (using the 8 msb for age)
-    bb::Depth   depth;      // 8 bit
-    NodeType    type;       // 8 bit
-    bb::Score   score;      // 16 bit
-    bb::Score   eval;  	    // 16 bit -> 112 bit = 14 byte
+// header of a saved table. The buckets follow the header which is padded to a full page so the
+// buckets can be mapped into memory directly.
+struct TTFileHeader {
+    char    magic[8];
+    bb::U64 version;
+    // hash of the network which has been used. Scores and evaluations depend on it
+    bb::U64 network;
+    bb::U64 bucketSize;
+    bb::U64 buckets;
+    bb::U64 age;
 };
 
+constexpr bb::U64 TT_FILE_HEADER_SIZE = 4096;
+
+// the upper bits of the key select the bucket while the lower 32 bits are stored to verify that an
+// entry belongs to the position. Both do not overlap as long as there are at most 2^32 buckets.
+[[nodiscard]] inline bb::U32 verificationKey(bb::U64 zobrist) { return static_cast<bb::U32>(zobrist); }
+
 class TranspositionTable {
     private:
-    NodeAge                  m_currentAge;
-    bb::U64                  m_size;
-    std::unique_ptr<Entry[]> m_entries;
-    bb::U64                  m_mask;
+    NodeAge                   m_currentAge;
+    bb::U64                   m_size;
+    Bucket*                   m_buckets = nullptr;
+    // the page type requested for the table and the page type which has actually been obtained
+    mem::PageType             m_requestedPages = mem::TRANSPARENT_HUGE_PAGES;
+    mem::PageType             m_pages          = mem::DEFAULT_PAGES;
+    // if the pages shall be / are interleaved across numa nodes
+    bool                      m_interleave     = false;
+    bool                      m_interleaved    = false;
 
-    void init(bb::U64 MB);
+    [[nodiscard]] bb::U64 index(bb::U64 zobrist) const;
+
+    [[nodiscard]] int fraction(bb::U64 zobrist) const;
+
+    [[nodiscard]] int worth(const Entry& entry) const;
+
+    void rehash(const Bucket* oldBuckets, bb::U64 oldSize, int threads);
+
+    void init(bb::U64 MB, int threads);
 
     public:
     TranspositionTable(bb::U64 mb);
 
+    ~TranspositionTable();
+
     TranspositionTable(const TranspositionTable& other) = delete;
 
     TranspositionTable& operator=(const TranspositionTable& other) = delete;
 
-    [[nodiscard]] Entry get(bb::U64 zobrist) const;
+    [[nodiscard]] Entry get(bb::U64 zobrist, TTStats* stats = nullptr) const;
 
-    bool put(bb::U64 zobrist, bb::Score score, move::Move move, NodeType type, bb::Depth depth, bb::Score eval);
+    bool put(bb::U64 zobrist, bb::Score score, move::Move move, NodeType type, bb::Depth depth, bb::Score eval,
+             TTStats* stats = nullptr);
 
     void incrementAge();
 
-    void setSize(bb::U64 mb);
+    void setSize(bb::U64 mb, int threads = 1);
+
+    void setPageType(mem::PageType type, int threads = 1);
+
+    [[nodiscard]] mem::PageType pageType() const;
 
-    void clear();
+    void setInterleave(bool interleave, int threads = 1);
+
+    [[nodiscard]] bool interleaved() const;
+
+    [[nodiscard]] double probeLatency(int probes) const;
+
+    void clear(int threads = 1);
 
     [[nodiscard]] double usage() const;
 
+    [[nodiscard]] TTOccupancy occupancy(bb::U64 buckets) const;
+
+    bool save(const std::string& path, bb::U64 network) const;
+
+    bool load(const std::string& path, bb::U64 network);
+
     [[nodiscard]] bb::U64 getSize() const;
 
     void prefetch(const bb::U64 zobrist) const;
 };
 
 
+// returns the maximum size in MB. The index bits and the verification key overlap for larger tables
 int maxTTSize();
 
 #endif    // CHESSCOMPUTER_HASHMAP_H
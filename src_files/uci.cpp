@@ -19,6 +19,7 @@
 
 #include "uci.h"
 #include "attacks.h"
+#include "movegen.h"
 #include "polyglot.h"
 #include "search.h"
 #include "uciassert.h"
@@ -38,7 +39,8 @@ using namespace move;
 TimeManager timeManager{};
 Board       board{};
 Search      searchObject;
-std::thread searchThread;
+std::string evalFile      = "<embedded>";
+bool        sharedNetwork = false;
 
 /**
  * assuming the input to the engine has been split by spaces into the given vector, this function
@@ -60,15 +62,11 @@ std::string getValue(const std::vector<std::string>& vec, const std::string& key
 }
 
 /**
- * this function will invoke the search with a given max depth and a time manager.
- * If no depth has been specified, it will be set to the maximum depth and the time manager will
- * handle all stop-management.
+ * prints the best move once the search running in the background finished.
  *
- * @param maxDepth
- * @param p_timeManager
+ * @param m
  */
-void searchAndPrint(TimeManager* p_timeManager) {
-    Move m = searchObject.bestMove(&board, p_timeManager);
+void printBestMove(Move m) {
     std::cout << "bestmove " << toString(m) << std::endl;
 }
 
@@ -82,7 +80,6 @@ void uci::mainloop(int argc, char* argv[]) {
     attacks::init();
     bb::init();
     nn::init();
-    searchObject = {};
     searchObject.init(16);
     
     
@@ -116,14 +113,28 @@ void uci::mainloop(int argc, char* argv[]) {
  * Also displays a list of all uci options which can be set. Finally, 'uciok' is sent back to receive further commands.
  */
 void uci::uci() {
+#ifdef USE_DISPATCH
+    // report the kernels which have been chosen at startup
+    std::cout << "id name Koivisto " << MAJOR_VERSION << "." << MINOR_VERSION
+              << " (" << nn::instructionSet() << (attacks::usePext ? ", pext" : "") << ")" << std::endl;
+#else
     std::cout << "id name Koivisto " << MAJOR_VERSION << "." << MINOR_VERSION << std::endl;
+#endif
     std::cout << "id author K. Kahre, F. Eggers" << std::endl;
     std::cout << "option name Hash type spin default 16 min 1 max " << maxTTSize() << std::endl;
+    std::cout << "option name LargePages type combo default Transparent var Off var Transparent var Explicit" << std::endl;
+    std::cout << "option name HashStats type check default false" << std::endl;
+    std::cout << "option name NumaInterleave type check default false" << std::endl;
     std::cout << "option name Threads type spin default 1 min 1 max " << MAX_THREADS << std::endl;
+    std::cout << "option name HelperDepthSkip type check default true" << std::endl;
+    std::cout << "option name HelperStagger type spin default 2 min 0 max 16" << std::endl;
+    std::cout << "option name HelperAspirationOffset type spin default 5 min 0 max 100" << std::endl;
     std::cout << "option name MultiPV type spin default 1 min 1 max " << MAX_MULTIPV << std::endl;
     std::cout << "option name OwnBook type check default false" << std::endl;
     std::cout << "option name BookPath type string" << std::endl;
     std::cout << "option name SyzygyPath type string default" << std::endl;
+    std::cout << "option name EvalFile type string default <embedded>" << std::endl;
+    std::cout << "option name SharedNetwork type check default false" << std::endl;
     std::cout << "option name MoveOverhead type spin default 0 min 0 max 10000" << std::endl;
     std::cout << "option name MoveOverheadType type combo default PerMove var PerMove var PerGame" << std::endl;
     std::cout << "uciok" << std::endl;
@@ -137,7 +148,7 @@ void uci::eval() {
     nn::Evaluator evaluator{};
     evaluator.reset(&board);
     
-    auto base_eval = evaluator.evaluate(board.getActivePlayer());
+    auto base_eval = evaluator.evaluate(board.getActivePlayer(), &board);
     std::cout << "eval=" << base_eval << std::endl;
     
     
@@ -267,8 +278,32 @@ void uci::processCommand(std::string str) {
     } else if (split.at(0) == "eval") {
         uci::eval();
         
+    } else if (split.at(0) == "tt") {
+        if (split.size() > 1 && split.at(1) == "stats")
+            searchObject.printHashStats();
+        if (split.size() > 1 && split.at(1) == "latency")
+            searchObject.printHashLatency();
+        // the path may contain spaces so we use everything after the sub command
+        if (split.size() > 2) {
+            std::string path = str.substr(str.find(split.at(1)) + split.at(1).size());
+            path             = trim(path);
+            if (split.at(1) == "save")
+                searchObject.saveHash(path);
+            if (split.at(1) == "load")
+                searchObject.loadHash(path);
+        }
     } else if (split.at(0) == "bench"){
-        bench();
+        if (split.size() > 1 && split.at(1) == "eval")
+            benchEval();
+        else if (split.size() > 1 && split.at(1) == "smp")
+            benchSmp(split.size() > 2 ? std::stoi(split.at(2)) : 12);
+        else
+            bench();
+    } else if (split.at(0) == "evalbatch"){
+        if (split.size() < 3)
+            std::cout << "info string usage: evalbatch <infile> <outfile>" << std::endl;
+        else
+            evalBatch(split.at(1), split.at(2));
     } else if (split.at(0) == "exit" || split.at(0) == "quit"){
         exit(0);
     }
@@ -300,9 +335,7 @@ void uci::go_perft(int depth, bool hash) {
  */
 void uci::stop() {
     searchObject.stop();
-    if (searchThread.joinable()) {
-        searchThread.join();
-    }
+    searchObject.waitForSearch();
 }
 
 /**
@@ -310,13 +343,33 @@ void uci::stop() {
  * Sets internal search options.
  * - SyzygyPath
  * - Threads
+ * - HelperDepthSkip
+ * - HelperStagger
+ * - HelperAspirationOffset
  * - Hash
+ * - LargePages
+ * - HashStats
+ * - NumaInterleave
+ * - EvalFile
+ * - SharedNetwork
  * @param name
  * @param value
  */
 void uci::set_option(const std::string& name, const std::string& value) {
     if (name == "Hash") {
         searchObject.setHashSize(stoi(value));
+    } else if (name == "LargePages") {
+        if (value == "Off") {
+            searchObject.setHashPageType(mem::DEFAULT_PAGES);
+        } else if (value == "Explicit") {
+            searchObject.setHashPageType(mem::EXPLICIT_HUGE_PAGES);
+        } else {
+            searchObject.setHashPageType(mem::TRANSPARENT_HUGE_PAGES);
+        }
+    } else if (name == "NumaInterleave") {
+        searchObject.setHashInterleave(value == "true");
+    } else if (name == "HashStats") {
+        searchObject.setHashStats(value == "true");
     } else if (name == "SyzygyPath") {
         if (value.empty())
             return;
@@ -331,9 +384,30 @@ void uci::set_option(const std::string& name, const std::string& value) {
          * only use TB if loading was successful
          */
         searchObject.useTableBase(TB_LARGEST > 0);
+    } else if (name == "EvalFile" || name == "SharedNetwork") {
+        const std::string file   = name == "EvalFile" ? value : evalFile;
+        const bool        shared = name == "SharedNetwork" ? value == "true" : sharedNetwork;
+        if (file == "<embedded>") {
+            nn::useEmbeddedNetwork();
+        } else if (!nn::loadNetwork(file)) {
+            return;
+        }
+        evalFile      = file;
+        sharedNetwork = shared && nn::shareNetwork();
+        // evaluations computed with the previous network need to be discarded
+        searchObject.clearHash();
+
+        std::cout << "info string using network " << evalFile << (sharedNetwork ? " (shared)" : "")
+                  << std::endl;
     } else if (name == "Threads") {
         int count           = stoi(value);
         searchObject.setThreads(count);
+    } else if (name == "HelperDepthSkip") {
+        searchObject.setHelperDepthSkip(value == "true");
+    } else if (name == "HelperStagger") {
+        searchObject.setHelperStagger(stoi(value));
+    } else if (name == "HelperAspirationOffset") {
+        searchObject.setHelperAspirationOffset(stoi(value));
     } else if (name == "MultiPV") {
         int count           = stoi(value);
         searchObject.setMultiPv(count);
@@ -360,6 +434,8 @@ void uci::set_option(const std::string& name, const std::string& value) {
 void uci::isReady() {
     // TODO check if its running
 
+    // resizing and clearing the hash is done in the background. We are ready once its done
+    searchObject.waitForHash();
     std::cout << "readyok" << std::endl;
 }
 
@@ -511,6 +587,268 @@ void uci::bench() {
     searchObject.enableInfoStrings();
 }
 
+/**
+ * measures the time to reach the given depth on the positions used for the bench with 1, 2, 4, 8, 16 and 32
+ * threads. The speedup is relative to searching with a single thread. The amount of threads is limited by the
+ * available cores, so thread counts which exceed them are only benchmarked once.
+ * @param depth
+ */
+void uci::benchSmp(int depth) {
+    static const char* Benchmarks[] = {
+#include "bench.csv"
+        ""};
+
+    const int previousThreads = searchObject.getThreads();
+    int       lastThreads     = 0;
+    int       singleTime      = 0;
+
+    searchObject.disableInfoStrings();
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+        searchObject.setThreads(threads);
+        if (searchObject.getThreads() == lastThreads)
+            continue;
+        lastThreads = searchObject.getThreads();
+
+        U64 nodes = 0;
+        int time  = 0;
+        for (int i = 0; strcmp(Benchmarks[i], ""); i++) {
+            Board b(Benchmarks[i]);
+
+            TimeManager manager{};
+            manager.setDepthLimit(depth);
+            searchObject.bestMove(&b, &manager);
+            SearchOverview overview = searchObject.overview();
+
+            nodes += overview.nodes;
+            time  += overview.time;
+
+            searchObject.clearHash();
+            searchObject.clearHistory();
+        }
+        if (lastThreads == 1)
+            singleTime = time;
+
+        printf("Threads %3d: %12d nodes %8d ms %8d nps  speedup %5.2f\n", lastThreads, static_cast<int>(nodes),
+               time, static_cast<int>(1000.0f * nodes / (time + 1)), static_cast<double>(singleTime + 1) / (time + 1));
+        std::cout << std::flush;
+    }
+    searchObject.setThreads(previousThreads);
+    searchObject.enableInfoStrings();
+}
+
+/**
+ * benchmarks the network on the positions used for the bench. Each legal move of each position is made and the
+ * child is evaluated like in the search. We measure separately:
+ *   - the incremental updates of the accumulators, grouped by the type of the move
+ *   - the refreshes through the accumulator table if a king crossed a bucket
+ *   - the forward passes of the evaluator once the accumulators are up to date
+ * Updates and refreshes are counted for each view separately since a king move can refresh one view while
+ * the other one is updated incrementally. Incremental updates and forward passes are repeated on each child
+ * to get meaningful timings. The share of each part is the time it takes when evaluating each child once.
+ */
+void uci::benchEval() {
+    static const char* Benchmarks[] = {
+#include "bench.csv"
+        ""};
+
+    constexpr int ROUNDS      = 4;
+    constexpr int REPETITIONS = 64;
+
+    enum Part { QUIET_UPDATE, CAPTURE_UPDATE, CASTLE_UPDATE, EN_PASSANT_UPDATE, PROMOTION_UPDATE, KING_UPDATE,
+                REFRESH, FORWARD, N_PARTS };
+    static const char* names[N_PARTS] {"update quiet", "update capture", "update castle", "update en passant",
+                                       "update promotion", "update king", "refresh", "forward"};
+
+    // operations timed and the time spent in nanoseconds for each part. The amount of children of each part is
+    // used to compute the share of time spent
+    U64 operations[N_PARTS] {};
+    U64 nanos     [N_PARTS] {};
+    U64 children  [N_PARTS] {};
+
+    using Clock = std::chrono::steady_clock;
+    auto elapsed = [](Clock::time_point start) {
+        return static_cast<U64>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    };
+
+    Board    b {};
+    MoveList moves {};
+    MoveList replies {};
+    int      positions = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; strcmp(Benchmarks[i], ""); i++) {
+            b.setFen(Benchmarks[i]);
+            positions++;
+
+            moves.clear();
+            generatePerftMoves(&b, &moves);
+            for (int j = 0; j < moves.getSize(); j++) {
+                const Move m = moves.getMove(j);
+                if (!b.isLegal(m))
+                    continue;
+
+                b.move(m);
+                nn::Evaluator*        evaluator = b.getEvaluator();
+                nn::AccumulatorDelta& delta     = evaluator->deltas[evaluator->ply];
+
+                // a view whose king crossed a bucket is refreshed through the table. In the search, the entry
+                // has usually been written by a close position, e.g. the same king move one ply deeper in
+                // another branch. We emulate this by storing the position after a reply of the opponent
+                // which has the same pieces as the same king move played after that reply.
+                // A refresh can only be timed once since the table contains the position afterwards
+                for (Color view : {WHITE, BLACK}) {
+                    if (!delta.refresh[view])
+                        continue;
+
+                    replies.clear();
+                    generatePerftMoves(&b, &replies);
+                    for (int k = 0; k < replies.getSize(); k++) {
+                        if (!b.isLegal(replies.getMove(k)))
+                            continue;
+                        b.move(replies.getMove(k));
+                        evaluator->table()->use(view, &b, *evaluator);
+                        b.undoMove();
+                        break;
+                    }
+
+                    const auto start = Clock::now();
+                    evaluator->table()->use(view, &b, *evaluator);
+                    nanos     [REFRESH] += elapsed(start);
+                    operations[REFRESH] ++;
+                    children  [REFRESH] ++;
+                    delta.computed[view] = true;
+                }
+
+                // the other views are updated incrementally, including the view of the opponent when castling
+                // or moving the king across a bucket
+                const int views = !delta.refresh[WHITE] + !delta.refresh[BLACK];
+                if (views > 0) {
+                    Part part = QUIET_UPDATE;
+                    if (isCastle(m))
+                        part = CASTLE_UPDATE;
+                    else if (isEnPassant(m))
+                        part = EN_PASSANT_UPDATE;
+                    else if (isPromotion(m))
+                        part = PROMOTION_UPDATE;
+                    else if (isCapture(m))
+                        part = CAPTURE_UPDATE;
+                    else if (getMovingPieceType(m) == KING)
+                        part = KING_UPDATE;
+
+                    const auto start = Clock::now();
+                    for (int r = 0; r < REPETITIONS; r++) {
+                        delta.computed[WHITE] = delta.refresh[WHITE];
+                        delta.computed[BLACK] = delta.refresh[BLACK];
+                        evaluator->update(&b);
+                    }
+                    nanos     [part] += elapsed(start);
+                    operations[part] += REPETITIONS * views;
+                    children  [part] += views;
+                }
+
+                // the accumulators are up to date so this only runs the forward pass
+                const auto start = Clock::now();
+                for (int r = 0; r < REPETITIONS; r++) {
+                    (void) evaluator->evaluate(b.getActivePlayer(), &b);
+                }
+                nanos     [FORWARD] += elapsed(start);
+                operations[FORWARD] += REPETITIONS;
+                children  [FORWARD] ++;
+
+                b.undoMove();
+            }
+        }
+    }
+
+    // time spent on each part if each child is evaluated once
+    double perChild[N_PARTS] {};
+    double total = 0;
+    for (int p = 0; p < N_PARTS; p++) {
+        if (operations[p] == 0)
+            continue;
+        perChild[p] = static_cast<double>(nanos[p]) / operations[p] * children[p];
+        total      += perChild[p];
+    }
+
+    printf("Eval bench over %d positions and %d children (%s)\n", positions, static_cast<int>(children[FORWARD]),
+           nn::instructionSet().c_str());
+    for (int p = 0; p < N_PARTS; p++) {
+        const double nsPerOp = operations[p] ? static_cast<double>(nanos[p]) / operations[p] : 0;
+        printf("%-18s %12d ops %10.1f ns/op %12d ops/s %6.1f %%\n", names[p], static_cast<int>(operations[p]),
+               nsPerOp, static_cast<int>(nsPerOp > 0 ? 1e9 / nsPerOp : 0), total > 0 ? 100 * perChild[p] / total : 0);
+    }
+    std::cout << std::flush;
+}
+
+/**
+ * evaluates all positions given as fens in the input file, one per line, and writes the static evaluation from the
+ * perspective of the side to move into the output file, one per line. The positions are read in chunks and each
+ * chunk is split evenly across all configured threads. Each thread reuses a single board so that evaluating a
+ * position does not allocate any memory.
+ * @param in
+ * @param out
+ */
+void uci::evalBatch(const std::string& in, const std::string& out) {
+    constexpr size_t CHUNK_SIZE = 1 << 16;
+
+    std::ifstream input(in);
+    if (!input.is_open()) {
+        std::cout << "info string could not open " << in << std::endl;
+        return;
+    }
+    std::ofstream output(out);
+    if (!output.is_open()) {
+        std::cout << "info string could not open " << out << std::endl;
+        return;
+    }
+
+    const int threadCount = searchObject.getThreads();
+
+    // everything which is used per position is allocated once upfront and reused for every chunk
+    std::vector<Board>       boards(threadCount);
+    std::vector<std::string> fens(CHUNK_SIZE);
+    std::vector<Score>       scores(CHUNK_SIZE);
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+
+    U64 positions = 0;
+    startMeasure();
+    while (input) {
+        // read the next chunk. Empty lines are skipped
+        size_t count = 0;
+        while (count < CHUNK_SIZE && std::getline(input, fens[count])) {
+            if (!trim(fens[count]).empty())
+                count++;
+        }
+        if (count == 0)
+            break;
+
+        // each thread evaluates a contiguous block of the chunk
+        auto worker = [&boards, &fens, &scores, count, threadCount](int t) {
+            const size_t start = count * t / threadCount;
+            const size_t end   = count * (t + 1) / threadCount;
+            for (size_t i = start; i < end; i++) {
+                boards[t].setFen(fens[i]);
+                scores[i] = boards[t].evaluate();
+            }
+        };
+        for (int t = 1; t < threadCount; t++)
+            threads.emplace_back(worker, t);
+        worker(0);
+        for (auto& th : threads)
+            th.join();
+        threads.clear();
+
+        for (size_t i = 0; i < count; i++)
+            output << scores[i] << "\n";
+        positions += count;
+    }
+    output.flush();
+    const auto time = stopMeasure();
+
+    std::cout << "info string evaluated " << positions << " positions in " << time << " ms ("
+              << positions * 1000 / (time + 1) << " positions per second)" << std::endl;
+}
+
 /**
  * parses any go command
  * Format: go [option 1] [value] [option 2] [value] ....
@@ -578,5 +916,5 @@ void uci::go(const std::vector<std::string>& split, const std::string& str) {
         // don't do anything since we don't support it
     }
     // start the search
-    searchThread = std::thread(searchAndPrint, &timeManager);
+    searchObject.start(&board, &timeManager, printBestMove);
 }
@@ -59,6 +59,10 @@ void position_fen(const std::string& fen, const std::string& moves);
 void position_startpos(const std::string& moves);
 
 void bench();
+void benchEval();
+void benchSmp(int depth);
+
+void evalBatch(const std::string& in, const std::string& out);
 
 void quit();
 }